@@ -17,6 +17,20 @@ class DistSource {
   virtual ~DistSource() {}
   virtual void InitializeForFile(const std::string& glob,
                                  std::vector<std::string>* files) = 0;
+
+  // Hint that InitializeForFile(glob) will be called soon. Implementations
+  // may start fetching in the background; the default does nothing.
+  virtual void PrefetchForFile(const std::string& glob) {}
+
+  // Returns the contents of 'path', a file InitializeForFile has already
+  // seen. Dies if the file cannot be read.
+  virtual std::string ReadFile(const std::string& path) = 0;
+
+  // Sets 'fingerprint' to a hex content hash of 'path', avoiding reading
+  // the file when the version control system can vouch for its contents.
+  // Returns false if the file cannot be read.
+  virtual bool FileFingerprint(const std::string& path,
+                               std::string* fingerprint) = 0;
   virtual void WriteMakeFile(Makefile* out) = 0;
   virtual void WriteMakeClean(Makefile::Rule* out) = 0;
   virtual void WriteMakeHead(const Input& input, Makefile* out) = 0;
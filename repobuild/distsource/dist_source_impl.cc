@@ -8,11 +8,16 @@
 #include "common/log/log.h"
 #include "repobuild/distsource/dist_source_impl.h"
 #include "repobuild/distsource/git_tree.h"
+#include "repobuild/distsource/worker_pool.h"
 
 DEFINE_bool(enable_git_tree, true,
             "If false, we do not run any git commands during "
             "execution or in the makefile.");
 
+DEFINE_int32(git_init_threads, 8,
+             "Number of submodules we check out concurrently while parsing. "
+             "If 0, submodules are checked out inline, one at a time.");
+
 using std::string;
 using std::vector;
 
@@ -20,11 +25,18 @@ namespace repobuild {
 
 DistSourceImpl::DistSourceImpl(const string& root_dir) {
   if (FLAGS_enable_git_tree) {
-    git_tree_.reset(new GitTree(root_dir));
+    if (FLAGS_git_init_threads > 0) {
+      pool_.reset(new WorkerPool(FLAGS_git_init_threads));
+    }
+    git_tree_.reset(new GitTree(root_dir, pool_.get()));
   }
 }
 
 DistSourceImpl::~DistSourceImpl() {
+  // Finish any prefetched checkouts before the trees go away.
+  if (pool_.get() != NULL) {
+    pool_->Wait();
+  }
 }
 
 void DistSourceImpl::InitializeForFile(const string& glob,
@@ -45,6 +57,24 @@ void DistSourceImpl::InitializeForFile(const string& glob,
   }
 }
 
+void DistSourceImpl::PrefetchForFile(const string& glob) {
+  if (git_tree_.get() != NULL) {
+    git_tree_->PrefetchChild(glob);
+  }
+}
+
+string DistSourceImpl::ReadFile(const string& path) {
+  return file::ReadFileToStringOrDie(path);
+}
+
+bool DistSourceImpl::FileFingerprint(const string& path,
+                                     string* fingerprint) {
+  if (git_tree_.get() != NULL) {
+    return git_tree_->Fingerprint(path, fingerprint);
+  }
+  return GitTree::HashFile(path, fingerprint);
+}
+
 void DistSourceImpl::WriteMakeFile(Makefile* out) {
   if (git_tree_.get() != NULL) {
     git_tree_->WriteMakeFile(out);
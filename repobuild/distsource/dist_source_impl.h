@@ -13,6 +13,7 @@
 namespace repobuild {
 class GitTree;
 class Input;
+class WorkerPool;
 
 class DistSourceImpl : public DistSource {
  public:
@@ -21,6 +22,10 @@ class DistSourceImpl : public DistSource {
 
   virtual void InitializeForFile(const std::string& glob,
                                  std::vector<std::string>* files);
+  virtual void PrefetchForFile(const std::string& glob);
+  virtual std::string ReadFile(const std::string& path);
+  virtual bool FileFingerprint(const std::string& path,
+                               std::string* fingerprint);
   virtual void WriteMakeFile(Makefile* out);
   virtual void WriteMakeClean(Makefile::Rule* out);
   virtual void WriteMakeHead(const Input& input, Makefile* out);
@@ -28,6 +33,7 @@ class DistSourceImpl : public DistSource {
  private:
   DISALLOW_COPY_AND_ASSIGN(DistSourceImpl);
 
+  std::unique_ptr<WorkerPool> pool_;
   std::unique_ptr<GitTree> git_tree_;
 };
 
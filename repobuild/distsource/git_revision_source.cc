@@ -0,0 +1,269 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <fnmatch.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "common/log/log.h"
+#include "common/strings/path.h"
+#include "common/strings/strutil.h"
+#include "common/util/stl.h"
+#include "repobuild/distsource/git_revision_source.h"
+#include "repobuild/distsource/git_util.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace repobuild {
+
+struct GitRevisionSource::Repository {
+  Repository() : root(NULL) {}
+  ~Repository() { DeleteValues(&submodules); }
+
+  ScopedGitRepo repo;
+  string path;  // relative to root_dir_, "" for the superproject.
+  const git_tree* root;  // owned by 'trees'.
+  map<string, std::unique_ptr<git_tree, GitFree_Tree> > trees;  // by oid.
+  map<string, Repository*> submodules;  // by local path, NULL if missing.
+};
+
+namespace {
+// Splits 'path' (relative to the root or under it) into components.
+vector<string> PathComponents(const string& root_dir, const string& path) {
+  string clean = strings::CleanPath(path);
+  if (strings::HasPrefix(clean, root_dir + "/")) {
+    clean = clean.substr(root_dir.size() + 1);
+  }
+  vector<string> components;
+  for (const string& component : strings::SplitString(clean, "/")) {
+    if (!component.empty() && component != ".") {
+      components.push_back(component);
+    }
+  }
+  return components;
+}
+
+bool IsGlobPattern(const string& component) {
+  return component.find_first_of("*?[") != string::npos;
+}
+}  // anonymous namespace
+
+GitRevisionSource::GitRevisionSource(const string& root_dir,
+                                     const string& revision)
+    : root_dir_(strings::CleanPath(root_dir)),
+      root_(new Repository) {
+  InitGitLibrary();
+  root_->repo.reset(OpenRepo(root_dir_));
+  CHECK(root_->repo.get()) << "Not a git repository: " << root_dir_;
+
+  git_object* object_ptr = NULL;
+  CHECK_EQ(0, git_revparse_single(&object_ptr, root_->repo.get(),
+                                  revision.c_str()))
+      << "Unknown git revision \"" << revision << "\": " << GitError();
+  ScopedGitObject object(object_ptr);
+  git_object* tree_ptr = NULL;
+  CHECK_EQ(0, git_object_peel(&tree_ptr, object.get(), GIT_OBJ_TREE))
+      << "Git revision \"" << revision << "\" has no tree: " << GitError();
+  ScopedGitObject tree(tree_ptr);
+  root_->root = LookupTree(root_.get(), git_object_id(tree.get()));
+  CHECK(root_->root) << "Could not read tree for revision " << revision;
+
+  LOG(INFO) << "Reading BUILD files at revision " << revision << " ("
+            << GitOidString(git_object_id(object.get())) << ")";
+}
+
+GitRevisionSource::~GitRevisionSource() {
+}
+
+void GitRevisionSource::InitializeForFile(const string& glob,
+                                          vector<string>* files) {
+  vector<string> components = PathComponents(root_dir_, glob);
+  if (components.empty()) {
+    return;
+  }
+  vector<string> tmp;
+  Glob(root_.get(), root_->root, "", components, 0, &tmp);
+  std::sort(tmp.begin(), tmp.end());  // same order as glob(3).
+  if (files != NULL) {
+    files->insert(files->end(), tmp.begin(), tmp.end());
+  }
+}
+
+string GitRevisionSource::ReadFile(const string& path) {
+  Repository* repo = NULL;
+  git_oid oid;
+  if (!FindBlob(path, &repo, &oid)) {
+    LOG(FATAL) << "Could not read file at revision: " << path;
+  }
+  git_blob* blob_ptr = NULL;
+  CHECK_EQ(0, git_blob_lookup(&blob_ptr, repo->repo.get(), &oid))
+      << "Could not read blob for " << path << ": " << GitError();
+  ScopedGitBlob blob(blob_ptr);
+  return string(static_cast<const char*>(git_blob_rawcontent(blob.get())),
+                git_blob_rawsize(blob.get()));
+}
+
+bool GitRevisionSource::FileFingerprint(const string& path,
+                                        string* fingerprint) {
+  Repository* repo = NULL;
+  git_oid oid;
+  if (!FindBlob(path, &repo, &oid)) {
+    return false;
+  }
+  *fingerprint = GitOidString(&oid);
+  return true;
+}
+
+bool GitRevisionSource::FindBlob(const string& path,
+                                 Repository** repo,
+                                 git_oid* oid) {
+  vector<string> components = PathComponents(root_dir_, path);
+  Repository* current = root_.get();
+  const git_tree* tree = current->root;
+  string full_path;
+  for (int i = 0; i < components.size(); ++i) {
+    const git_tree_entry* entry =
+        git_tree_entry_byname(tree, components[i].c_str());
+    if (entry == NULL) {
+      return false;
+    }
+    full_path = strings::JoinPath(full_path, components[i]);
+    switch (git_tree_entry_type(entry)) {
+      case GIT_OBJ_BLOB:
+        if (i + 1 != components.size()) {
+          return false;
+        }
+        *repo = current;
+        git_oid_cpy(oid, git_tree_entry_id(entry));
+        return true;
+      case GIT_OBJ_TREE:
+        tree = LookupTree(current, git_tree_entry_id(entry));
+        break;
+      case GIT_OBJ_COMMIT:
+        current = OpenSubmodule(current, full_path, git_tree_entry_id(entry));
+        tree = (current != NULL ? current->root : NULL);
+        break;
+      default:
+        return false;
+    }
+    if (tree == NULL) {
+      return false;
+    }
+  }
+  return false;  // a directory.
+}
+
+void GitRevisionSource::Glob(Repository* repo,
+                             const git_tree* tree,
+                             const string& prefix,
+                             const vector<string>& components,
+                             int index,
+                             vector<string>* output) {
+  const string& pattern = components[index];
+  bool last = (index + 1 == components.size());
+  bool literal = !IsGlobPattern(pattern);
+  int count = literal ? 1 : git_tree_entrycount(tree);
+  for (int i = 0; i < count; ++i) {
+    const git_tree_entry* entry =
+        (literal ? git_tree_entry_byname(tree, pattern.c_str()) :
+         git_tree_entry_byindex(tree, i));
+    if (entry == NULL) {
+      continue;
+    }
+    const char* name = git_tree_entry_name(entry);
+    if (!literal && fnmatch(pattern.c_str(), name, FNM_PERIOD) != 0) {
+      continue;
+    }
+
+    string path = strings::JoinPath(prefix, name);
+    if (last) {
+      output->push_back(path);
+      continue;
+    }
+    if (git_tree_entry_type(entry) == GIT_OBJ_TREE) {
+      const git_tree* subtree = LookupTree(repo, git_tree_entry_id(entry));
+      if (subtree != NULL) {
+        Glob(repo, subtree, path, components, index + 1, output);
+      }
+    } else if (git_tree_entry_type(entry) == GIT_OBJ_COMMIT) {
+      Repository* submodule = OpenSubmodule(repo, path,
+                                            git_tree_entry_id(entry));
+      if (submodule != NULL) {
+        Glob(submodule, submodule->root, path, components, index + 1, output);
+      }
+    }
+  }
+}
+
+GitRevisionSource::Repository* GitRevisionSource::OpenSubmodule(
+    Repository* parent,
+    const string& path,
+    const git_oid* commit) {
+  string local_path = (parent->path.empty() ? path :
+                       path.substr(parent->path.size() + 1));
+  auto it = parent->submodules.find(local_path);
+  if (it != parent->submodules.end()) {
+    return it->second;
+  }
+
+  // NB: We assume the submodule name matches its path, which is what
+  // "git submodule add" does, rather than reading .gitmodules at 'commit'.
+  vector<string> candidates;
+  candidates.push_back(strings::JoinPath(
+      strings::JoinPath(git_repository_path(parent->repo.get()), "modules"),
+      local_path));
+  if (git_repository_workdir(parent->repo.get()) != NULL) {
+    candidates.push_back(strings::JoinPath(
+        git_repository_workdir(parent->repo.get()), local_path));
+  }
+
+  Repository* submodule = NULL;
+  for (const string& candidate : candidates) {
+    ScopedGitRepo repo(OpenRepo(candidate));
+    git_commit* commit_ptr = NULL;
+    if (repo.get() == NULL ||
+        git_commit_lookup(&commit_ptr, repo.get(), commit) != 0) {
+      continue;
+    }
+    git_tree* tree_ptr = NULL;
+    int error = git_commit_tree(&tree_ptr, commit_ptr);
+    git_commit_free(commit_ptr);
+    if (error != 0) {
+      continue;
+    }
+    submodule = new Repository;
+    submodule->repo.reset(repo.release());
+    submodule->path = path;
+    submodule->trees[GitOidString(git_tree_id(tree_ptr))].reset(tree_ptr);
+    submodule->root = tree_ptr;
+    break;
+  }
+  if (submodule == NULL) {
+    LOG(WARNING) << "Submodule " << path << " at " << GitOidString(commit)
+                 << " is not available locally, treating it as empty.";
+  }
+  parent->submodules[local_path] = submodule;
+  return submodule;
+}
+
+const git_tree* GitRevisionSource::LookupTree(Repository* repo,
+                                              const git_oid* oid) {
+  string key = GitOidString(oid);
+  auto it = repo->trees.find(key);
+  if (it != repo->trees.end()) {
+    return it->second.get();
+  }
+  git_tree* tree_ptr = NULL;
+  if (git_tree_lookup(&tree_ptr, repo->repo.get(), oid) != 0) {
+    LOG(WARNING) << "Could not read git tree " << key << ": " << GitError();
+    return NULL;
+  }
+  repo->trees[key].reset(tree_ptr);
+  return tree_ptr;
+}
+
+}  // namespace repobuild
@@ -0,0 +1,74 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// GitRevisionSource
+//  A DistSource that reads BUILD files and glob results straight out of the
+//  git object database at a fixed revision, so the build graph of any commit
+//  can be computed without checking it out. Submodules are followed through
+//  their gitlinks, using the clones under $GIT_DIR/modules (or an existing
+//  submodule work tree); submodules that were never cloned appear empty.
+
+#ifndef _REPOBUILD_DISTSOURCE_GIT_REVISION_SOURCE_H__
+#define _REPOBUILD_DISTSOURCE_GIT_REVISION_SOURCE_H__
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "common/base/macros.h"
+#include "repobuild/distsource/dist_source.h"
+
+struct git_oid;
+struct git_tree;
+
+namespace repobuild {
+class Input;
+
+class GitRevisionSource : public DistSource {
+ public:
+  // 'root_dir' is the top of the git work tree, 'revision' is anything
+  // "git rev-parse" accepts. Dies if the revision cannot be resolved.
+  GitRevisionSource(const std::string& root_dir, const std::string& revision);
+  virtual ~GitRevisionSource();
+
+  virtual void InitializeForFile(const std::string& glob,
+                                 std::vector<std::string>* files);
+  virtual std::string ReadFile(const std::string& path);
+  virtual bool FileFingerprint(const std::string& path,
+                               std::string* fingerprint);
+
+  // Nothing to fetch: every file comes from the object database.
+  virtual void WriteMakeFile(Makefile* out) {}
+  virtual void WriteMakeClean(Makefile::Rule* out) {}
+  virtual void WriteMakeHead(const Input& input, Makefile* out) {}
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(GitRevisionSource);
+
+  // One repository (the superproject or a submodule) at a fixed tree.
+  struct Repository;
+
+  Repository* OpenSubmodule(Repository* parent, const std::string& path,
+                            const git_oid* commit);
+  const git_tree* LookupTree(Repository* repo, const git_oid* oid);
+
+  // Matches path components [index, end) of a glob below 'tree'.
+  void Glob(Repository* repo,
+            const git_tree* tree,
+            const std::string& prefix,
+            const std::vector<std::string>& components,
+            int index,
+            std::vector<std::string>* output);
+
+  // Finds the blob at 'path'; returns false if there is no such file.
+  bool FindBlob(const std::string& path,
+                Repository** repo,
+                git_oid* oid);
+
+  std::string root_dir_;
+  std::unique_ptr<Repository> root_;
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_DISTSOURCE_GIT_REVISION_SOURCE_H__
@@ -1,24 +1,28 @@
 // Copyright 2013
 // Author: Christopher Van Arsdale
 
+#include <sys/stat.h>
+#include <fstream>
+#include <mutex>
 #include <memory>
 #include <string>
 #include <map>
+#include <vector>
 #include "common/base/init.h"
 #include "common/base/flags.h"
+#include "common/file/fileutil.h"
 #include "common/log/log.h"
 #include "common/util/shell.h"
 #include "common/util/stl.h"
 #include "common/strings/path.h"
 #include "common/strings/strutil.h"
 #include "common/util/stl.h"
-#include "repobuild/distsource/git_tree.h"
 #include "repobuild/distsource/flock_pl.h"
+#include "repobuild/distsource/git_tree.h"
+#include "repobuild/distsource/git_util.h"
+#include "repobuild/distsource/worker_pool.h"
 #include "repobuild/env/input.h"
 #include "repobuild/nodes/makefile.h"
-extern "C" {
-#include "repobuild/third_party/libgit2/include/git2.h"
-}
 
 DEFINE_bool(enable_repobuild_git, true,
             "If false, we do not fetch submodules during repobuild execution. "
@@ -29,57 +33,94 @@ DEFINE_bool(enable_makefile_git, true,
             "If false, we do not write make rules for fetching git "
             "submodules.");
 
+DEFINE_bool(git_sparse_submodules, false,
+            "If true, submodules are cloned with --depth 1 and only the "
+            "packages repobuild reads from them are checked out (git "
+            "sparse checkout). More paths are checked out as the build graph "
+            "reaches them. Falls back to a full checkout on any git error.");
+
 using std::map;
 using std::set;
 using std::string;
-using std::unique_ptr;
+using std::vector;
 
 namespace repobuild {
 namespace {
 
-#define GIT_FREE(x, p, f)                                        \
-  struct GitFree_##x {                                           \
-    void operator()(p *ptr) const {                              \
-      if (ptr) {                                                 \
-        f(ptr);                                                  \
-      }                                                          \
-    }                                                            \
-  };
-GIT_FREE(Repo, git_repository, git_repository_free);
-GIT_FREE(Index, git_index, git_index_free);
-
-typedef unique_ptr<git_repository, GitFree_Repo> ScopedGitRepo;
-typedef unique_ptr<git_index, GitFree_Index> ScopedGitIndex;
-
-#undef GIT_FREE
-
-git_repository* OpenRepo(const string& path) {
-  git_repository* repo_ptr = NULL;
-  int error = git_repository_open(&repo_ptr, path.c_str());
-  ScopedGitRepo repo(repo_ptr);
-  if (error != 0) {
-    const char* error = (giterr_last() && giterr_last()->message ?
-                         giterr_last()->message : "???");
-    VLOG(1) << "Git Open error: " << error;
-    return NULL;
-  }
-  return repo.release();
-}
-
 git_index* OpenIndex(git_repository* repo) {
   git_index* index_ptr = NULL;
   int error = git_repository_index(&index_ptr, repo);
   ScopedGitIndex index(index_ptr);
   if (error != 0) {
-    const char* error = (giterr_last() && giterr_last()->message ?
-                         giterr_last()->message : "???");
-    VLOG(1) << "Git Index error: " << error;
+    VLOG(1) << "Git Index error: " << GitError();
     return NULL;
   }
   git_index_read(index.get());
   return index.release();
 }
 
+// Returns the on-disk path of a submodule url we can fetch from without
+// going over the network, or "" if the url is remote (or relative to the
+// superproject's own remote, which we do not try to resolve).
+string LocalRemotePath(const string& url) {
+  const char kFilePrefix[] = "file://";
+  if (strings::HasPrefix(url, kFilePrefix)) {
+    return url.substr(sizeof(kFilePrefix) - 1);
+  }
+  if (strings::HasPrefix(url, "/")) {
+    return url;
+  }
+  return "";
+}
+
+// Makes 'url' usable with "git clone --depth": plain local paths need the
+// file:// transport, otherwise git ignores --depth.
+string ShallowCloneUrl(const string& url) {
+  if (strings::HasPrefix(url, "/")) {
+    return "file://" + url;
+  }
+  if (strings::HasPrefix(url, "./") || strings::HasPrefix(url, "../")) {
+    return "";  // relative to the superproject's remote.
+  }
+  return url;
+}
+
+// Sparse-checkout patterns covering 'path', which is relative to the
+// submodule root. Packages get their whole directory (make/cmake rules read
+// more than the files named in BUILD), while the submodule root only gets
+// its top level files.
+void AddSparsePatterns(const string& path, vector<string>* patterns) {
+  string dir = strings::PathDirname(strings::CleanPath(path));
+  if (path.empty() || dir.empty() || dir == "." || dir == "/") {
+    patterns->push_back("/*");
+    patterns->push_back("!/*/");
+  } else {
+    patterns->push_back("/" + dir + "/");
+  }
+}
+
+// Equivalent of "git submodule init": registers the url in .git/config.
+git_submodule* InitSubmoduleConfig(git_repository* parent,
+                                   const string& submodule,
+                                   std::mutex* config_mutex) {
+  git_submodule* sm = NULL;  // owned by 'parent'.
+  if (git_submodule_lookup(&sm, parent, submodule.c_str()) != 0) {
+    VLOG(1) << "Git submodule lookup error: " << GitError();
+    return NULL;
+  }
+  std::lock_guard<std::mutex> lock(*config_mutex);
+  if (git_submodule_init(sm, 0 /* no overwrite */) != 0) {
+    VLOG(1) << "Git submodule init error: " << GitError();
+    return NULL;
+  }
+  return sm;
+}
+
+const git_oid* SubmoduleCommit(git_submodule* sm) {
+  const git_oid* oid = git_submodule_index_id(sm);
+  return oid != NULL ? oid : git_submodule_head_id(sm);
+}
+
 string FlockScript(const string& scratch_dir) {
   const char kFlockScript[] = "flock_script.pl";
   return strings::JoinPath(scratch_dir, kFlockScript);
@@ -92,30 +133,103 @@ struct GitTree::GitData {
   ScopedGitIndex index;
 };
 
-GitTree::GitTree(const string& root_path)
-    : root_dir_(root_path) {
+GitTree::GitTree(const string& root_path, WorkerPool* pool)
+    : root_dir_(root_path),
+      pool_(pool),
+      index_mtime_(0),
+      init_state_(NOT_STARTED),
+      sparse_dirty_(false) {
+  InitGitLibrary();
   Reset();
+  if (Initialized()) {
+    init_state_ = FINISHED;
+  }
 }
 
 void GitTree::Reset() {
-  data_.reset(new GitData);
+  // Pool threads read data_ and children_ (under mutex_) while we check out,
+  // so build the new state on the side and swap it in.
+  std::unique_ptr<GitData> data(new GitData);
+  long index_mtime = 0;
 
   // Initialize git.
-  data_->repo.reset(OpenRepo(root_dir_));
-  if (data_->repo.get()) {
-    data_->index.reset(OpenIndex(data_->repo.get()));
+  data->repo.reset(OpenRepo(root_dir_));
+  if (data->repo.get()) {
+    data->index.reset(OpenIndex(data->repo.get()));
+    struct stat index_stat;
+    string index_file = strings::JoinPath(
+        git_repository_path(data->repo.get()), "index");
+    if (stat(index_file.c_str(), &index_stat) == 0) {
+      index_mtime = index_stat.st_mtime;
+    }
   }
 
   // Find all of our submodules.
-  if (data_->index.get() != NULL) {
-    int count = git_index_entrycount(data_->index.get());
+  set<string> submodules;
+  if (data->index.get() != NULL) {
+    int count = git_index_entrycount(data->index.get());
     for (int i = 0; i < count; ++i) {
-      const git_index_entry *e = git_index_get_byindex(data_->index.get(), i);
+      const git_index_entry *e = git_index_get_byindex(data->index.get(), i);
       if (e->mode == 0xE000 /* special submodule identifier */) {
-        children_[e->path] = new GitTree(strings::JoinPath(root_dir_, e->path));
+        submodules.insert(e->path);
       }
     }
   }
+  map<string, GitTree*> children;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    children = children_;
+  }
+  map<string, GitTree*> stale;
+  for (auto it : children) {
+    if (submodules.find(it.first) == submodules.end()) {
+      stale.insert(it);
+    }
+  }
+  for (auto it : stale) {
+    children.erase(it.first);
+  }
+  for (const string& submodule : submodules) {
+    if (children.find(submodule) == children.end()) {
+      children[submodule] = new GitTree(
+          strings::JoinPath(root_dir_, submodule), pool_);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    data_.swap(data);
+    index_mtime_ = index_mtime;
+    children_.swap(children);
+  }
+  // Only a tree without an index (not checked out yet) is reset, and it has
+  // no children, so nobody can still be using these.
+  DeleteValues(&stale);
+
+  // Pick up a sparse checkout, whether ours or from a previous run.
+  if (FLAGS_git_sparse_submodules && data_->repo.get() != NULL) {
+    git_config* config_ptr = NULL;
+    int sparse = 0;
+    if (git_repository_config(&config_ptr, data_->repo.get()) == 0) {
+      ScopedGitConfig config(config_ptr);
+      if (git_config_get_bool(&sparse, config.get(),
+                              "core.sparseCheckout") != 0) {
+        sparse = 0;
+      }
+    }
+    if (sparse) {
+      string sparse_file = strings::JoinPath(
+          git_repository_path(data_->repo.get()), "info/sparse-checkout");
+      std::ifstream in(sparse_file.c_str());
+      std::lock_guard<std::mutex> lock(mutex_);
+      string line;
+      while (std::getline(in, line)) {
+        if (!line.empty()) {
+          sparse_patterns_.insert(line);
+        }
+      }
+      sparse_file_ = sparse_file;
+    }
+  }
 }
 
 GitTree::~GitTree() {
@@ -123,6 +237,7 @@ GitTree::~GitTree() {
 }
 
 bool GitTree::Initialized() const {
+  std::lock_guard<std::mutex> lock(mutex_);
   return data_->index.get() != NULL;
 }
 
@@ -142,58 +257,389 @@ bool IsSubmodule(const string& path,
 }  // anonymous namespace
 
 void GitTree::ExpandChild(const string& path) {
-  VLOG(2) << "GitTree::ExpandChild: " << path;
-  bool found_anything = false;
+  ExpandChild(path, true);
+}
+
+void GitTree::PrefetchChild(const string& path) {
+  ExpandChild(path, false);
+}
+
+void GitTree::ExpandChild(const string& path, bool wait) {
+  VLOG(2) << "GitTree::ExpandChild: " << path << (wait ? "" : " (prefetch)");
+  string submodule, remainder;
+  GitTree* tree = FindSubmodule(path, &submodule, &remainder);
+  if (tree == NULL) {
+    VLOG(1) << "Path not found in submodules: " << path;
+    return;
+  }
+  if (FLAGS_git_sparse_submodules) {
+    // Our own sparse checkout (if any) must include the submodule directory.
+    AddSparsePattern("/" + submodule);
+    tree->AddSparsePath(remainder);
+  }
+  if (!wait) {
+    // Nested submodules are prefetched by the worker once 'tree' is ready.
+    if (FLAGS_enable_repobuild_git) {
+      tree->StartInitialize(this, submodule, remainder);
+    }
+    return;
+  }
+
+  if (FLAGS_enable_repobuild_git) {
+    MaterializeSparsePaths();
+    tree->StartInitialize(this, submodule, "");
+    tree->WaitForInitialize();
+    tree->MaterializeSparsePaths();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    used_submodules_.insert(submodule);
+  }
+  tree->ExpandChild(remainder, true);
+}
+
+GitTree* GitTree::FindSubmodule(const string& path,
+                                string* submodule,
+                                string* remainder) const {
+  std::lock_guard<std::mutex> lock(mutex_);
   for (auto it : children_) {
-    const string& submodule = it.first;
-    GitTree* tree = it.second;
     // TODO(cvanarsdale): Globs would be nice here. However, it's not exactly
     // trivial to glob against a prefix. You could probably pop path components
     // off of 'path' and use a glob library to match the substring against
     // "submodule".
-    string remainder;
-    if (IsSubmodule(path, submodule, &remainder)) {
-      found_anything = true;
-      if (!tree->Initialized() && FLAGS_enable_repobuild_git) {
-        InitializeSubmodule(submodule, tree);
+    if (IsSubmodule(path, it.first, remainder)) {
+      *submodule = it.first;
+      return it.second;
+    }
+  }
+  return NULL;
+}
+
+void GitTree::StartInitialize(GitTree* parent,
+                              const string& submodule,
+                              const string& prefetch_path) {
+  bool finished = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished = (init_state_ == FINISHED);
+    if (!finished) {
+      if (!prefetch_path.empty()) {
+        pending_prefetch_.push_back(prefetch_path);
+      }
+      if (init_state_ == RUNNING) {
+        return;  // FinishInitialize picks up pending_prefetch_.
       }
-      used_submodules_.insert(submodule);
-      tree->ExpandChild(remainder);
-      break;
+      init_state_ = RUNNING;
     }
   }
-  VLOG_IF(1, !found_anything) << "Path not found in submodules: " << path;
+  if (finished) {
+    if (!prefetch_path.empty()) {
+      PrefetchChild(prefetch_path);
+    }
+    return;
+  }
+
+  auto closure = [parent, submodule, this]() {
+    parent->InitializeSubmodule(submodule, this);
+  };
+  if (pool_ != NULL) {
+    pool_->Schedule(closure);
+  } else {
+    closure();
+  }
+}
+
+void GitTree::WaitForInitialize() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  init_cv_.wait(lock, [this]() { return init_state_ == FINISHED; });
+}
+
+void GitTree::FinishInitialize() {
+  Reset();
+  vector<string> prefetch;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    init_state_ = FINISHED;
+    prefetch.swap(pending_prefetch_);
+  }
+  init_cv_.notify_all();
+
+  // Anything requested while we were checking out is now safe to expand.
+  for (const string& path : prefetch) {
+    PrefetchChild(path);
+  }
 }
 
 void GitTree::RecordFile(const string& path) {
-  for (auto it : children_) {
-    const string& submodule = it.first;
-    GitTree* tree = it.second;
-    string remainder;
-    if (IsSubmodule(path, submodule, &remainder)) {
-      used_submodules_.insert(submodule);
-      tree->RecordFile(remainder);
-      return;
-    }
+  string submodule, remainder;
+  GitTree* tree = FindSubmodule(path, &submodule, &remainder);
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (tree != NULL) {
+    used_submodules_.insert(submodule);
+    lock.unlock();
+    tree->RecordFile(remainder);
+    return;
   }
   if (!path.empty()) {
     seen_files_.insert(path);
   }
 }
 
+bool GitTree::Fingerprint(const string& path, string* fingerprint) const {
+  string submodule, remainder;
+  GitTree* tree = FindSubmodule(path, &submodule, &remainder);
+  if (tree != NULL) {
+    return tree->Fingerprint(remainder, fingerprint);
+  }
+
+  string full_path = strings::JoinPath(root_dir_, path);
+  struct stat file_stat;
+  if (stat(full_path.c_str(), &file_stat) != 0) {
+    return false;
+  }
+  {
+    // NB: index lookups may sort the entry list, so they are not
+    // thread-safe. A checkout in progress replaces data_.
+    std::lock_guard<std::mutex> lock(mutex_);
+    const git_index_entry* e = NULL;
+    if (init_state_ != RUNNING && data_->index.get() != NULL) {
+      e = git_index_get_bypath(data_->index.get(), path.c_str(), 0);
+    }
+    if (e != NULL &&
+        e->mtime.seconds == file_stat.st_mtime &&
+        e->mtime.seconds < index_mtime_ &&
+        e->ctime.seconds == file_stat.st_ctime &&
+        e->file_size == file_stat.st_size &&
+        e->ino == static_cast<unsigned int>(file_stat.st_ino)) {
+      *fingerprint = GitOidString(&e->oid);
+      return true;
+    }
+  }
+  VLOG(2) << "Hashing file not clean in git index: " << full_path;
+  return HashFile(full_path, fingerprint);
+}
+
+// static
+bool GitTree::HashFile(const string& full_path, string* fingerprint) {
+  InitGitLibrary();
+  git_oid oid;
+  if (git_odb_hashfile(&oid, full_path.c_str(), GIT_OBJ_BLOB) != 0) {
+    VLOG(1) << "Git hash error (" << full_path << "): " << GitError();
+    return false;
+  }
+  *fingerprint = GitOidString(&oid);
+  return true;
+}
+
+void GitTree::AddSparsePath(const string& path) {
+  vector<string> patterns;
+  AddSparsePatterns(path, &patterns);
+  for (const string& pattern : patterns) {
+    AddSparsePattern(pattern);
+  }
+}
+
+void GitTree::AddSparsePattern(const string& pattern) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (sparse_patterns_.insert(pattern).second) {
+    sparse_dirty_ = true;
+  }
+}
+
+void GitTree::MaterializeSparsePaths() {
+  std::lock_guard<std::mutex> sparse_lock(sparse_mutex_);
+  string sparse_file, contents;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sparse_file_.empty() || !sparse_dirty_) {
+      return;
+    }
+    sparse_file = sparse_file_;
+    for (const string& pattern : sparse_patterns_) {
+      contents.append(pattern + "\n");
+    }
+    sparse_dirty_ = false;
+  }
+  VLOG(1) << "Expanding sparse checkout: " << root_dir_;
+  file::WriteFileOrDie(sparse_file, contents);
+  if (util::Execute(strings::Join("(cd ", root_dir_, "; ",
+                                  "git read-tree -mu HEAD)")) != 0) {
+    LOG(ERROR) << "Could not expand sparse checkout: " << root_dir_
+               << ". Possible git error.";
+  }
+}
+
 void GitTree::InitializeSubmodule(const string& submodule, GitTree* sub_tree) {
   LOG(INFO) << "Initializing submodule: " << submodule;
-  // NB: Why use 'git' here instead of libgit2? This is to avoid requiring
-  // a bunch of libraries (ssl, ssh, zlib) needed to make git work correctly.
-  int retval = util::Execute(strings::Join(
-      "(cd ", root_dir_, "; ",
-      "git submodule update --init ", submodule, ")"));
-  if (retval != 0) {
-    LOG(ERROR) << "Could not expand submodule: "
-               << strings::JoinPath(root_dir_, submodule)
-               << ". Possible git error.";
+  if (FLAGS_git_sparse_submodules &&
+      SparseCheckoutSubmodule(submodule, sub_tree)) {
+    sub_tree->FinishInitialize();
+    return;
+  }
+  if (!CheckoutSubmodule(submodule)) {
+    // NB: Why use 'git' here instead of libgit2? This is to avoid requiring
+    // a bunch of libraries (ssl, ssh, zlib) needed to fetch from a network
+    // remote correctly.
+    int retval;
+    {
+      // git takes .git/config.lock for --init, so siblings go one at a time.
+      std::lock_guard<std::mutex> lock(config_mutex_);
+      retval = util::Execute(strings::Join(
+          "(cd ", root_dir_, "; ",
+          "git submodule update --init ", submodule, ")"));
+    }
+    if (retval != 0) {
+      LOG(ERROR) << "Could not expand submodule: "
+                 << strings::JoinPath(root_dir_, submodule)
+                 << ". Possible git error.";
+    }
+  }
+  sub_tree->FinishInitialize();
+}
+
+bool GitTree::CheckoutSubmodule(const string& submodule) {
+  // Each checkout gets its own handles; libgit2 objects are not shared
+  // across threads.
+  ScopedGitRepo parent(OpenRepo(root_dir_));
+  if (parent.get() == NULL) {
+    return false;
+  }
+
+  git_submodule* sm = InitSubmoduleConfig(parent.get(), submodule,
+                                          &config_mutex_);
+  if (sm == NULL) {
+    return false;
+  }
+  const git_oid* oid = SubmoduleCommit(sm);
+  if (oid == NULL) {
+    return false;
+  }
+
+  // Find local objects: either a previous clone under $GIT_DIR/modules, or
+  // a local remote we can clone from without the network.
+  string module_dir = strings::JoinPath(
+      strings::JoinPath(git_repository_path(parent.get()), "modules"),
+      git_submodule_name(sm));
+  ScopedGitRepo repo(OpenRepo(module_dir));
+  if (repo.get() == NULL) {
+    string remote = LocalRemotePath(git_submodule_url(sm) ?
+                                    git_submodule_url(sm) : "");
+    if (remote.empty()) {
+      return false;
+    }
+    git_clone_options opts = GIT_CLONE_OPTIONS_INIT;
+    opts.bare = 1;  // we attach the work tree below.
+    opts.checkout_opts.checkout_strategy = GIT_CHECKOUT_NONE;
+    git_repository* repo_ptr = NULL;
+    if (git_clone(&repo_ptr, remote.c_str(), module_dir.c_str(), &opts) != 0) {
+      VLOG(1) << "Git local clone error (" << remote << "): " << GitError();
+      return false;
+    }
+    repo.reset(repo_ptr);
+  }
+
+  // Point the module repository at our work tree (writes dest/.git).
+  string dest_dir = strings::JoinPath(root_dir_, submodule);
+  if (git_repository_set_workdir(repo.get(), dest_dir.c_str(),
+                                 1 /* update gitlink */) != 0) {
+    VLOG(1) << "Git set workdir error: " << GitError();
+    return false;
+  }
+  {
+    git_config* config_ptr = NULL;
+    if (git_repository_config(&config_ptr, repo.get()) == 0) {
+      ScopedGitConfig config(config_ptr);
+      git_config_set_bool(config.get(), "core.bare", 0);
+    }
   }
-  sub_tree->Reset();
+
+  // Check out the commit recorded by the superproject.
+  git_object* commit_ptr = NULL;
+  if (git_object_lookup(&commit_ptr, repo.get(), oid, GIT_OBJ_COMMIT) != 0) {
+    VLOG(1) << "Git commit not available locally: " << GitError();
+    return false;  // stale local objects, let git fetch.
+  }
+  ScopedGitObject commit(commit_ptr);
+  git_checkout_opts checkout = GIT_CHECKOUT_OPTS_INIT;
+  checkout.checkout_strategy = GIT_CHECKOUT_SAFE_CREATE;
+  if (git_checkout_tree(repo.get(), commit.get(), &checkout) != 0 ||
+      git_repository_set_head_detached(repo.get(), oid) != 0) {
+    LOG(ERROR) << "Git checkout error in " << dest_dir << ": " << GitError();
+    return false;
+  }
+  return true;
+}
+
+bool GitTree::SparseCheckoutSubmodule(const string& submodule,
+                                      GitTree* sub_tree) {
+  ScopedGitRepo parent(OpenRepo(root_dir_));
+  if (parent.get() == NULL) {
+    return false;
+  }
+  git_submodule* sm = InitSubmoduleConfig(parent.get(), submodule,
+                                          &config_mutex_);
+  if (sm == NULL) {
+    return false;
+  }
+  const git_oid* oid = SubmoduleCommit(sm);
+  string url = ShallowCloneUrl(git_submodule_url(sm) ?
+                               git_submodule_url(sm) : "");
+  if (oid == NULL || url.empty()) {
+    return false;
+  }
+  string sha = GitOidString(oid);
+
+  string module_dir = strings::JoinPath(
+      strings::JoinPath(git_repository_path(parent.get()), "modules"),
+      git_submodule_name(sm));
+  {
+    ScopedGitRepo existing(OpenRepo(module_dir));
+    if (existing.get() != NULL) {
+      return false;  // reuse the existing clone with a full checkout.
+    }
+  }
+  string dest_dir = strings::JoinPath(root_dir_, submodule);
+
+  // Shallow clone without a work tree, then check out only the patterns
+  // requested so far. The pinned commit is usually not the remote's tip, so
+  // fetch it by id (or, failing that, the whole history).
+  string contents;
+  {
+    std::lock_guard<std::mutex> lock(sub_tree->mutex_);
+    if (sub_tree->sparse_patterns_.empty()) {
+      vector<string> patterns;
+      AddSparsePatterns("", &patterns);
+      sub_tree->sparse_patterns_.insert(patterns.begin(), patterns.end());
+    }
+    for (const string& pattern : sub_tree->sparse_patterns_) {
+      contents.append(pattern + "\n");
+    }
+    sub_tree->sparse_dirty_ = false;
+  }
+  string in_dest = strings::Join("(cd ", dest_dir, "; ");
+  bool ok =
+      util::Execute(strings::Join(
+          "git clone -q --depth 1 --no-checkout --separate-git-dir=",
+          module_dir, " ", url, " ", dest_dir)) == 0 &&
+      util::Execute(in_dest + "git config core.sparseCheckout true)") == 0;
+  if (ok) {
+    file::WriteFileOrDie(strings::JoinPath(module_dir, "info/sparse-checkout"),
+                         contents);
+    ok = util::Execute(strings::Join(
+        in_dest,
+        "git cat-file -e ", sha, "^{commit} 2>/dev/null || ",
+        "git fetch -q --depth 1 origin ", sha, " || ",
+        "git fetch -q --unshallow origin) && ",
+        in_dest, "git checkout -q ", sha, ")")) == 0;
+  }
+  if (!ok) {
+    LOG(WARNING) << "Sparse checkout failed for " << dest_dir
+                 << ", falling back to a full checkout.";
+    util::Execute(strings::Join("rm -rf ", module_dir, " ",
+                                strings::JoinPath(dest_dir, ".git")));
+    return false;
+  }
+  return true;
 }
 
 void GitTree::WriteMakeFile(Makefile* out) const {
@@ -211,7 +657,7 @@ void GitTree::WriteMakeFile(Makefile* out,
   string current_scratch_dir = strings::JoinPath(out->scratch_dir(),
                                                  full_dir);
   string current_git_file = strings::JoinPath(current_dir, ".git");
-  string lockfile = strings::JoinPath(out->scratch_dir(), ".gitlock");
+  string current_lockfile = strings::JoinPath(current_scratch_dir, ".gitlock");
   string flock_script = FlockScript(out->scratch_dir());
   string prereqs = strings::JoinWith(" ", parent, flock_script);
 
@@ -228,6 +674,11 @@ void GitTree::WriteMakeFile(Makefile* out,
 
     string touchfile = strings::JoinPath(dest_scratch_dir, ".git_tree.dummy");
 
+    // Only "submodule init" takes our lock: it writes our .git/config,
+    // which sibling submodules share. The clone itself only writes the
+    // submodule's repository, so siblings fetch concurrently (and the
+    // submodule's own submodules wait for our touchfile).
+
     Makefile::Rule* rule = out->StartPrereqRule(touchfile, prereqs);
 
     // Target dir exists, target .git doesn't, and current .git does.
@@ -235,15 +686,16 @@ void GitTree::WriteMakeFile(Makefile* out,
                                  "//" + strings::JoinPath(full_dir, submodule) +
                                  " (git submodule)",
                                  dest_git_file);
+    rule->WriteCommand("mkdir -p " + dest_scratch_dir);
     rule->WriteCommand("if [ -d " + dest_dir + " -a " +
                        "! -f " + dest_git_file + " -a " +
                        " -e " + current_git_file + " ]; then "
-                       "touch " + lockfile + "; " +
-                       flock_script + " " + lockfile + " '"
+                       "touch " + current_lockfile + " && " +
+                       flock_script + " " + current_lockfile + " '"
                        "cd " + current_dir + "; "
-                       "git submodule update --init " + submodule +
-                       "'; fi");
-    rule->WriteCommand("mkdir -p " + dest_scratch_dir);
+                       "git submodule init " + submodule + "' && "
+                       "(cd " + current_dir + "; "
+                       "git submodule update " + submodule + "); fi");
     rule->WriteCommand("[ -f " + touchfile + " ] || "
                        "touch -t 197101010000 " + touchfile);
     out->FinishRule(rule);
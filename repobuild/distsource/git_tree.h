@@ -4,30 +4,79 @@
 #ifndef _REPOBUILD_DISTSOURCE_GIT_TREE_H__
 #define _REPOBUILD_DISTSOURCE_GIT_TREE_H__
 
+#include <condition_variable>
 #include <memory>
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 #include "common/base/macros.h"
 #include "repobuild/nodes/makefile.h"
 
 namespace repobuild {
 class Input;
+class WorkerPool;
 
 class GitTree {
  public:
-  explicit GitTree(const std::string& root_path);
+  // 'pool' is not owned, and may be NULL (submodules initialize inline).
+  GitTree(const std::string& root_path, WorkerPool* pool);
   ~GitTree();
 
   bool Initialized() const;
+
+  // ExpandChild blocks until every submodule covering 'path' is checked out.
+  // PrefetchChild only schedules those checkouts on the worker pool.
   void ExpandChild(const std::string& path);
+  void PrefetchChild(const std::string& path);
+
   void RecordFile(const std::string& path);
+
+  // Sets 'fingerprint' to the git blob id (hex) of 'path', relative to our
+  // root. Files whose stat data matches our (or a submodule's) index use the
+  // id recorded there; dirty, untracked and racily clean files are hashed.
+  // Returns false if the file cannot be read.
+  bool Fingerprint(const std::string& path, std::string* fingerprint) const;
+
+  // Hashes 'full_path' like "git hash-object".
+  static bool HashFile(const std::string& full_path, std::string* fingerprint);
   void WriteMakeFile(Makefile* out) const;
   void WriteMakeClean(Makefile::Rule* out) const;
   void WriteMakeHead(const Input& input, Makefile* out) const;
 
  private:
+  enum InitState {
+    NOT_STARTED,
+    RUNNING,
+    FINISHED
+  };
+
+  void ExpandChild(const std::string& path, bool wait);
+  GitTree* FindSubmodule(const std::string& path,
+                         std::string* submodule,
+                         std::string* remainder) const;
+
+  // Called on the child tree.
+  void StartInitialize(GitTree* parent,
+                       const std::string& submodule,
+                       const std::string& prefetch_path);
+  void WaitForInitialize();
+  void FinishInitialize();
+
+  // Sparse checkouts (--git_sparse_submodules), called on the child tree.
+  // Paths are relative to our root; MaterializeSparsePaths updates our work
+  // tree with anything added since the last checkout.
+  void AddSparsePath(const std::string& path);
+  void AddSparsePattern(const std::string& pattern);
+  void MaterializeSparsePaths();
+
+  // Called on the parent tree, possibly from a worker thread.
   void InitializeSubmodule(const std::string& submodule, GitTree* sub_tree);
+  bool CheckoutSubmodule(const std::string& submodule);
+  bool SparseCheckoutSubmodule(const std::string& submodule,
+                               GitTree* sub_tree);
+
   void Reset();
   void WriteMakeFile(Makefile* out,
                      const std::string& full_dir,
@@ -36,10 +85,29 @@ class GitTree {
 
   struct GitData;
   std::string root_dir_;
+  WorkerPool* pool_;
   std::unique_ptr<GitData> data_;
+  long index_mtime_;  // entries modified at or after this are racy.
   std::map<std::string, GitTree*> children_;
   std::set<std::string> used_submodules_;
   std::set<std::string> seen_files_;
+
+  // Submodule initialization state, guarded by mutex_.
+  mutable std::mutex mutex_;
+  std::condition_variable init_cv_;
+  InitState init_state_;
+  std::vector<std::string> pending_prefetch_;
+
+  // Serializes writes to our .git/config across sibling checkouts.
+  std::mutex config_mutex_;
+
+  // Sparse checkout state. sparse_file_ is empty unless our work tree is a
+  // sparse checkout. Guarded by mutex_, except sparse_mutex_ serializes
+  // updates to the work tree itself.
+  std::string sparse_file_;
+  std::set<std::string> sparse_patterns_;
+  bool sparse_dirty_;
+  std::mutex sparse_mutex_;
 };
 
 }  // namespace repobuild
@@ -0,0 +1,40 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <mutex>
+#include <string>
+#include "common/log/log.h"
+#include "repobuild/distsource/git_util.h"
+
+using std::string;
+
+namespace repobuild {
+
+const char* GitError() {
+  return (giterr_last() && giterr_last()->message ?
+          giterr_last()->message : "???");
+}
+
+void InitGitLibrary() {
+  static std::once_flag once;
+  std::call_once(once, []() { git_threads_init(); });
+}
+
+git_repository* OpenRepo(const string& path) {
+  git_repository* repo_ptr = NULL;
+  int error = git_repository_open(&repo_ptr, path.c_str());
+  ScopedGitRepo repo(repo_ptr);
+  if (error != 0) {
+    VLOG(1) << "Git Open error: " << GitError();
+    return NULL;
+  }
+  return repo.release();
+}
+
+string GitOidString(const git_oid* oid) {
+  char sha[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(sha, sizeof(sha), oid);
+  return sha;
+}
+
+}  // namespace repobuild
@@ -0,0 +1,55 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// Small helpers shared by the libgit2 backed sources: scoped handles,
+// error reporting and one-time library initialization.
+
+#ifndef _REPOBUILD_DISTSOURCE_GIT_UTIL_H__
+#define _REPOBUILD_DISTSOURCE_GIT_UTIL_H__
+
+#include <memory>
+#include <string>
+extern "C" {
+#include "repobuild/third_party/libgit2/include/git2.h"
+}
+
+namespace repobuild {
+
+#define GIT_FREE(x, p, f)                                        \
+  struct GitFree_##x {                                           \
+    void operator()(p *ptr) const {                              \
+      if (ptr) {                                                 \
+        f(ptr);                                                  \
+      }                                                          \
+    }                                                            \
+  };
+GIT_FREE(Repo, git_repository, git_repository_free);
+GIT_FREE(Index, git_index, git_index_free);
+GIT_FREE(Object, git_object, git_object_free);
+GIT_FREE(Config, git_config, git_config_free);
+GIT_FREE(Tree, git_tree, git_tree_free);
+GIT_FREE(Blob, git_blob, git_blob_free);
+
+typedef std::unique_ptr<git_repository, GitFree_Repo> ScopedGitRepo;
+typedef std::unique_ptr<git_index, GitFree_Index> ScopedGitIndex;
+typedef std::unique_ptr<git_object, GitFree_Object> ScopedGitObject;
+typedef std::unique_ptr<git_config, GitFree_Config> ScopedGitConfig;
+typedef std::unique_ptr<git_tree, GitFree_Tree> ScopedGitTree;
+typedef std::unique_ptr<git_blob, GitFree_Blob> ScopedGitBlob;
+
+#undef GIT_FREE
+
+// Message of the last libgit2 error on this thread.
+const char* GitError();
+
+// Safe to call any number of times, from any thread.
+void InitGitLibrary();
+
+// Returns NULL if 'path' is not a git repository.
+git_repository* OpenRepo(const std::string& path);
+
+std::string GitOidString(const git_oid* oid);
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_DISTSOURCE_GIT_UTIL_H__
@@ -0,0 +1,72 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "repobuild/distsource/worker_pool.h"
+
+namespace repobuild {
+
+WorkerPool::WorkerPool(int num_threads)
+    : active_(0),
+      stopping_(false) {
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.push_back(std::thread(&WorkerPool::Run, this));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  Wait();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkerPool::Schedule(const std::function<void()>& closure) {
+  if (threads_.empty()) {
+    closure();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(closure);
+  }
+  work_cv_.notify_one();
+}
+
+void WorkerPool::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this]() { return queue_.empty() && active_ == 0; });
+}
+
+void WorkerPool::Run() {
+  while (true) {
+    std::function<void()> closure;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;  // stopping_.
+      }
+      closure = queue_.front();
+      queue_.pop_front();
+      ++active_;
+    }
+
+    closure();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --active_;
+    }
+    done_cv_.notify_all();
+  }
+}
+
+}  // namespace repobuild
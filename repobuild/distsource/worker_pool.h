@@ -0,0 +1,47 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// WorkerPool
+//  A small bounded pool of threads. Closures are run in the order they were
+//  scheduled by at most 'num_threads' workers. With zero threads, Schedule()
+//  runs the closure inline.
+
+#ifndef _REPOBUILD_DISTSOURCE_WORKER_POOL_H__
+#define _REPOBUILD_DISTSOURCE_WORKER_POOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "common/base/macros.h"
+
+namespace repobuild {
+
+class WorkerPool {
+ public:
+  explicit WorkerPool(int num_threads);
+  ~WorkerPool();  // waits for all scheduled work.
+
+  void Schedule(const std::function<void()>& closure);
+
+  // Blocks until there is no queued or running work.
+  void Wait();
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(WorkerPool);
+
+  void Run();
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_, done_cv_;
+  std::deque<std::function<void()> > queue_;
+  std::vector<std::thread> threads_;
+  int active_;
+  bool stopping_;
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_DISTSOURCE_WORKER_POOL_H__
@@ -17,6 +17,10 @@ DEFINE_bool(enable_flto_object_files, true,
 DEFINE_bool(silent_make, true,
             "If false, make prints out commands before execution.");
 
+DEFINE_bool(time_actions, false,
+            "If true, make records the wall time, CPU time, max RSS and exit "
+            "status of every command in .gen-files/timing/actions.log.");
+
 // TODO(cvanarsdale): A default configuration file ('.repobuild') that contains
 // flags. We can search the path/tree/homedir for it.
 
@@ -98,6 +102,7 @@ Input::Input() {
   }
 
   silent_make_ = FLAGS_silent_make;
+  time_actions_ = FLAGS_time_actions;
 }
 
 const std::vector<std::string>& Input::flags(const std::string& key) const {
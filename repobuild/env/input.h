@@ -39,6 +39,7 @@ class Input {
     return build_target_set_.find(target) != build_target_set_.end();
   }
   bool silent_make() const { return silent_make_; }
+  bool time_actions() const { return time_actions_; }
 
  private:
   std::string root_dir_;
@@ -54,6 +55,7 @@ class Input {
   std::map<std::string, std::vector<std::string> > flags_;
 
   bool silent_make_;
+  bool time_actions_;
 };
 
 }  // namespace repobuild
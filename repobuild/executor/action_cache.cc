@@ -0,0 +1,313 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "common/log/log.h"
+#include "common/strings/path.h"
+#include "common/strings/strutil.h"
+#include "repobuild/executor/action_cache.h"
+#include "repobuild/third_party/json/json.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace repobuild {
+namespace {
+// Bump to drop every entry, e.g. when the key changes.
+const char kKeyVersion[] = "repobuild action cache 1";
+
+// Variables that change what the tools do without showing in the command.
+const char* kEnvironment[] = {
+  "PATH", "LD_LIBRARY_PATH", "LANG", "LC_ALL", "JAVA_HOME", "CLASSPATH",
+  "PKG_CONFIG_PATH", NULL
+};
+
+bool ReadFile(const string& path, string* contents) {
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  std::ostringstream out;
+  out << in.rdbuf();
+  *contents = out.str();
+  return !in.bad();
+}
+
+// The first word of each command in 'command' (e.g. "g++" and "ar" from
+// "mkdir -p x && g++ ... | ar ..."), which are the programs it starts.
+vector<string> CommandTools(const string& command) {
+  vector<string> tools;
+  bool at_start = true;
+  string word;
+  for (int i = 0; i <= command.size(); ++i) {
+    char c = (i < command.size() ? command[i] : '\n');
+    bool separator = (c == ';' || c == '&' || c == '|' || c == '(' ||
+                      c == ')' || c == '\n');
+    if (separator || c == ' ' || c == '\t') {
+      if (!word.empty() && at_start) {
+        if (word.find('=') == string::npos) {  // skips "VAR=value cmd".
+          tools.push_back(word);
+          at_start = false;
+        }
+      } else if (!word.empty()) {
+        at_start = false;
+      }
+      word.clear();
+      if (separator) {
+        at_start = true;
+      }
+      continue;
+    }
+    word += c;
+  }
+  return tools;
+}
+
+// True if 'entry' (see Store) has exactly the files 'action' writes, so a
+// bad entry from a shared store cannot write anywhere else.
+bool ValidEntry(const Json::Value& entry, const ActionGraph::Action& action) {
+  std::set<string> expected(action.outputs.begin(), action.outputs.end());
+  if (!action.depfile.empty()) {
+    expected.insert(action.depfile);
+  }
+  if (!entry.isArray() || entry.size() != expected.size()) {
+    return false;
+  }
+  for (int i = 0; i < entry.size(); ++i) {
+    const Json::Value& file = entry[i];
+    if (!file.isObject() || !file["path"].isString() ||
+        !file["blob"].isString() || !file["executable"].isBool() ||
+        expected.erase(file["path"].asString()) != 1) {
+      return false;
+    }
+  }
+  return expected.empty();
+}
+}  // anonymous namespace
+
+ActionCache::ActionCache() {
+}
+
+ActionCache::~ActionCache() {
+}
+
+void ActionCache::AddStore(CacheStore* store) {
+  stores_.push_back(std::unique_ptr<CacheStore>(store));
+}
+
+bool ActionCache::Get(const string& kind, const string& key,
+                      string* contents) {
+  for (int i = 0; i < stores_.size(); ++i) {
+    if (stores_[i]->Get(kind, key, contents)) {
+      for (int j = 0; j < i; ++j) {
+        stores_[j]->Put(kind, key, *contents);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ActionCache::GetBlobs(const vector<string>& ids,
+                           map<string, string>* blobs) {
+  vector<string> missing = ids;
+  for (int i = 0; i < stores_.size() && !missing.empty(); ++i) {
+    map<string, string> found;
+    stores_[i]->GetBlobs(missing, &found);
+    for (auto it = found.begin(); it != found.end(); ) {
+      if (FileHasher::HashString(it->second) != it->first) {
+        LOG(WARNING) << "Ignoring corrupt cache blob: " << it->first;
+        found.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+    for (int j = 0; j < i && !found.empty(); ++j) {
+      stores_[j]->PutBlobs(found);
+    }
+    blobs->insert(found.begin(), found.end());
+    vector<string> still_missing;
+    for (const string& id : missing) {
+      if (found.find(id) == found.end()) {
+        still_missing.push_back(id);
+      }
+    }
+    missing.swap(still_missing);
+  }
+  return missing.empty();
+}
+
+string ActionCache::ToolHash(const string& tool) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = tool_hashes_.find(tool);
+    if (it != tool_hashes_.end()) {
+      return it->second;
+    }
+  }
+  // Shell builtins and functions find nothing, which is fine.
+  vector<string> candidates;
+  if (tool.find('/') != string::npos) {
+    candidates.push_back(tool);
+  } else if (getenv("PATH") != NULL) {
+    for (const string& dir : strings::SplitString(getenv("PATH"), ":")) {
+      candidates.push_back(strings::JoinPath(dir.empty() ? "." : dir, tool));
+    }
+  }
+  string hash;
+  for (const string& candidate : candidates) {
+    if (access(candidate.c_str(), X_OK) == 0 &&
+        hasher_.HashFile(candidate, &hash)) {
+      break;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  tool_hashes_[tool] = hash;
+  return hash;
+}
+
+bool ActionCache::ActionKey(const ActionGraph::Action& action, string* key) {
+  string material = strings::StringPrintf("%s\ncommand %s\n", kKeyVersion,
+                                          action.command.c_str());
+  for (int i = 0; kEnvironment[i] != NULL; ++i) {
+    const char* value = getenv(kEnvironment[i]);
+    material += strings::StringPrintf("env %s=%s\n", kEnvironment[i],
+                                      value == NULL ? "" : value);
+  }
+  for (const string& tool : CommandTools(action.command)) {
+    material += "tool " + tool + " " + ToolHash(tool) + "\n";
+  }
+  for (const string& input : action.inputs) {
+    string hash;
+    if (!hasher_.HashFile(input, &hash)) {
+      return false;
+    }
+    material += "input " + input + " " + hash + "\n";
+  }
+  *key = FileHasher::HashString(material);
+  return true;
+}
+
+bool ActionCache::FullKey(const string& key,
+                          const vector<string>& headers,
+                          string* full_key) {
+  if (headers.empty()) {
+    *full_key = key;
+    return true;
+  }
+  string material = key + "\n";
+  for (const string& header : headers) {
+    string hash;
+    if (!hasher_.HashFile(header, &hash)) {
+      return false;  // e.g. a header that has since been removed.
+    }
+    material += "header " + header + " " + hash + "\n";
+  }
+  *full_key = FileHasher::HashString(material);
+  return true;
+}
+
+bool ActionCache::Restore(const ActionGraph::Action& action) {
+  string key, full_key, contents;
+  if (!action.cacheable || !ActionKey(action, &key)) {
+    return false;
+  }
+  vector<string> headers;
+  if (!action.depfile.empty()) {
+    if (!Get("deps", key, &contents)) {
+      return false;
+    }
+    for (const string& header : strings::SplitString(contents, "\n")) {
+      if (!header.empty()) {
+        headers.push_back(header);
+      }
+    }
+  }
+  if (!FullKey(key, headers, &full_key) || !Get("ac", full_key, &contents)) {
+    return false;
+  }
+  Json::Value entry;
+  Json::Reader reader;
+  if (!reader.parse(contents, entry) || !ValidEntry(entry, action)) {
+    LOG(WARNING) << "Ignoring corrupt cache entry: ac/" << full_key;
+    return false;
+  }
+
+  // Fetch every blob first, so a miss leaves the outputs alone.
+  vector<string> ids;
+  for (int i = 0; i < entry.size(); ++i) {
+    ids.push_back(entry[i]["blob"].asString());
+  }
+  map<string, string> blobs;
+  if (!GetBlobs(ids, &blobs)) {
+    return false;
+  }
+  for (int i = 0; i < entry.size(); ++i) {
+    string path = entry[i]["path"].asString();
+    string hash;
+    if (action.restat && hasher_.HashFile(path, &hash) &&
+        hash == ids[i]) {
+      continue;  // left alone, like the command would have.
+    }
+    if (!DiskCacheStore::WriteAtomically(path, blobs[ids[i]],
+                                         entry[i]["executable"].asBool())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ActionCache::Store(const ActionGraph::Action& action) {
+  string key, full_key;
+  if (!action.cacheable || !ActionKey(action, &key)) {
+    return;
+  }
+  vector<string> headers, outputs = action.outputs;
+  if (!action.depfile.empty()) {
+    ActionGraph::ReadDepfile(action.depfile, &headers);
+    outputs.push_back(action.depfile);
+  }
+  if (!FullKey(key, headers, &full_key)) {
+    return;
+  }
+
+  Json::Value entry(Json::arrayValue);
+  map<string, string> blobs;
+  for (const string& output : outputs) {
+    struct stat file_stat;
+    string contents;
+    if (stat(output.c_str(), &file_stat) != 0 ||
+        !S_ISREG(file_stat.st_mode) || !ReadFile(output, &contents)) {
+      return;
+    }
+    string blob = FileHasher::HashString(contents);
+    blobs[blob] = contents;
+    Json::Value file(Json::objectValue);
+    file["path"] = output;
+    file["blob"] = blob;
+    file["executable"] = ((file_stat.st_mode & S_IXUSR) != 0);
+    entry.append(file);
+  }
+  Json::FastWriter writer;
+  for (const auto& store : stores_) {
+    // Blobs before the entries pointing at them.
+    store->PutBlobs(blobs);
+    if (!action.depfile.empty()) {
+      store->Put("deps", key, strings::JoinAll(headers, "\n") + "\n");
+    }
+    store->Put("ac", full_key, writer.write(entry));
+  }
+}
+
+}  // namespace repobuild
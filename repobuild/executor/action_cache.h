@@ -0,0 +1,94 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// ActionCache
+//  Remembers the outputs of the actions the Executor runs, so running the
+//  same command on the same inputs again (e.g. after switching branches and
+//  back) restores them instead. Any action type works, since each one is
+//  just a command with its inputs and outputs (see action_graph.h).
+//
+//  An action's key hashes its command, the contents of the programs it
+//  starts, a few environment variables and the contents of its inputs. The
+//  headers of a compile are only known from its depfile after it ran, so
+//  that takes two steps: deps/<key> lists the headers the last stored run
+//  read, and the outputs are stored under the key of those headers'
+//  current contents as well.
+//
+//  The entries live in one or more CacheStores (see cache_store.h), e.g. a
+//  local directory and then a cache server, looked up in order. Hits from a
+//  later store are copied to the earlier ones, and new entries go to all:
+//    cas/<blob id>  file contents.
+//    ac/<key>       outputs of an action, JSON: path, blob, executable.
+//    deps/<key>     headers of an action, one per line.
+
+#ifndef _REPOBUILD_EXECUTOR_ACTION_CACHE_H__
+#define _REPOBUILD_EXECUTOR_ACTION_CACHE_H__
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "common/base/macros.h"
+#include "repobuild/executor/action_graph.h"
+#include "repobuild/executor/cache_store.h"
+#include "repobuild/executor/file_hasher.h"
+
+namespace repobuild {
+
+class ActionCache {
+ public:
+  ActionCache();
+  ~ActionCache();
+
+  // Takes ownership. Stores are searched in the order they were added.
+  void AddStore(CacheStore* store);
+
+  // Fingerprints inputs from 'source' where it can (see FileHasher). Not
+  // owned, may be NULL.
+  void SetDistSource(DistSource* source) { hasher_.SetDistSource(source); }
+
+  // Writes the outputs of 'action' (and its depfile) as they were after an
+  // identical run. Returns false on a miss, or if 'action' is not
+  // cacheable, leaving the outputs alone.
+  bool Restore(const ActionGraph::Action& action);
+
+  // Saves the outputs of 'action', which just ran successfully. Only
+  // cacheable actions are (see ActionGraph::Action), and only if they left
+  // none of their outputs missing.
+  void Store(const ActionGraph::Action& action);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ActionCache);
+
+  // Hash of the command, its tools and environment, and 'action.inputs'.
+  // Returns false if an input cannot be read.
+  bool ActionKey(const ActionGraph::Action& action, std::string* key);
+
+  // Extends 'key' with the contents of 'headers'.
+  bool FullKey(const std::string& key,
+               const std::vector<std::string>& headers,
+               std::string* full_key);
+
+  // Blob id of the program 'tool' runs (looked up in $PATH), or "".
+  std::string ToolHash(const std::string& tool);
+
+  // Looks 'key' up in each store, copying a hit to the stores before it.
+  bool Get(const std::string& kind, const std::string& key,
+           std::string* contents);
+
+  // All of 'ids', or false if a blob is in none of the stores.
+  bool GetBlobs(const std::vector<std::string>& ids,
+                std::map<std::string, std::string>* blobs);
+
+  std::vector<std::unique_ptr<CacheStore> > stores_;
+
+  FileHasher hasher_;
+
+  std::mutex mutex_;
+  std::map<std::string, std::string> tool_hashes_;
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_EXECUTOR_ACTION_CACHE_H__
@@ -0,0 +1,263 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "common/log/log.h"
+#include "common/strings/strutil.h"
+#include "repobuild/executor/action_graph.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace repobuild {
+namespace {
+bool IsVariableChar(char c) {
+  return isalnum(c) || c == '_' || c == '-';
+}
+
+// Expands ninja escapes and $variables from 'scope'.
+string Evaluate(const string& value, const map<string, string>& scope) {
+  string out;
+  for (int i = 0; i < value.size(); ++i) {
+    if (value[i] != '$' || i + 1 == value.size()) {
+      out += value[i];
+      continue;
+    }
+    char next = value[++i];
+    if (next == '$' || next == ' ' || next == ':') {
+      out += next;
+      continue;
+    }
+    string name;
+    if (next == '{') {
+      size_t end = value.find('}', i);
+      name = value.substr(i + 1, end - i - 1);
+      i = (end == string::npos ? value.size() : end);
+    } else {
+      while (i < value.size() && IsVariableChar(value[i])) {
+        name += value[i++];
+      }
+      --i;
+    }
+    auto it = scope.find(name);
+    if (it != scope.end()) {
+      out += it->second;
+    }
+  }
+  return out;
+}
+
+// Splits a list of paths on unescaped spaces.
+vector<string> SplitPaths(const string& paths) {
+  vector<string> out;
+  string current;
+  for (int i = 0; i < paths.size(); ++i) {
+    if (paths[i] == '$' && i + 1 < paths.size()) {
+      current += paths[i];
+      current += paths[++i];
+    } else if (paths[i] == ' ') {
+      if (!current.empty()) {
+        out.push_back(Evaluate(current, map<string, string>()));
+        current.clear();
+      }
+    } else {
+      current += paths[i];
+    }
+  }
+  if (!current.empty()) {
+    out.push_back(Evaluate(current, map<string, string>()));
+  }
+  return out;
+}
+
+// Splits "key = value".
+bool ParseBinding(const string& line, string* key, string* value) {
+  size_t equals = line.find('=');
+  if (equals == string::npos) {
+    return false;
+  }
+  size_t start = line.find_first_not_of(' ');
+  if (start >= equals) {
+    return false;
+  }
+  size_t end = line.find_last_not_of(' ', equals - 1);
+  *key = line.substr(start, end + 1 - start);
+  size_t value_start = line.find_first_not_of(' ', equals + 1);
+  *value = (value_start == string::npos ? "" : line.substr(value_start));
+  return true;
+}
+}  // anonymous namespace
+
+bool ActionGraph::Parse(const string& manifest) {
+  map<string, Rule> rules;
+  enum { NONE, POOL, RULE, BUILD } block = NONE;
+  string block_name;
+  map<string, string> bindings;  // of the current block.
+  string build_rule;
+  Action build;
+
+  // Applies the bindings of the block that just ended.
+  auto finish_block = [&]() -> bool {
+    if (block == POOL) {
+      pool_depth_[block_name] = atoi(bindings["depth"].c_str());
+    } else if (block == RULE) {
+      Rule* rule = &rules[block_name];
+      rule->command = bindings["command"];
+      rule->depfile = bindings["depfile"];
+      rule->restat = (bindings["restat"] == "1");
+      rule->generator = (bindings["generator"] == "1");
+    } else if (block == BUILD) {
+      map<string, string> scope;
+      for (const auto& it : bindings) {
+        scope[it.first] = Evaluate(it.second, map<string, string>());
+      }
+      scope["out"] = strings::JoinAll(build.outputs, " ");
+      scope["in"] = strings::JoinAll(build.inputs, " ");
+      if (build_rule != "phony") {
+        auto it = rules.find(build_rule);
+        if (it == rules.end()) {
+          LOG(ERROR) << "Unknown ninja rule: " << build_rule;
+          return false;
+        }
+        build.command = Evaluate(it->second.command, scope);
+        build.depfile = Evaluate(it->second.depfile, scope);
+        build.restat = it->second.restat;
+        build.generator = it->second.generator;
+      }
+      build.pool = scope["pool"];
+      build.kind = scope["kind"];
+      build.label = scope["label"];
+      build.cacheable = (scope["cacheable"] == "1");
+      for (const string& output : build.outputs) {
+        producers_[output] = actions_.size();
+      }
+      actions_.push_back(build);
+    }
+    block = NONE;
+    bindings.clear();
+    return true;
+  };
+
+  for (const string& line : strings::SplitString(manifest, "\n")) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    if (line[0] == ' ') {
+      string key, value;
+      if (block == NONE || !ParseBinding(line, &key, &value)) {
+        LOG(ERROR) << "Unexpected ninja line: " << line;
+        return false;
+      }
+      bindings[key] = value;
+      continue;
+    }
+    if (!finish_block()) {
+      return false;
+    }
+
+    size_t space = line.find(' ');
+    string keyword = line.substr(0, space);
+    string rest = (space == string::npos ? "" : line.substr(space + 1));
+    if (keyword == "pool" || keyword == "rule") {
+      block = (keyword == "pool" ? POOL : RULE);
+      block_name = rest;
+    } else if (keyword == "build") {
+      size_t colon = 0;
+      while ((colon = rest.find(':', colon)) != string::npos &&
+             colon > 0 && rest[colon - 1] == '$') {
+        ++colon;
+      }
+      if (colon == string::npos) {
+        LOG(ERROR) << "Invalid ninja build line: " << line;
+        return false;
+      }
+      build = Action();
+      build.outputs = SplitPaths(rest.substr(0, colon));
+      vector<string> inputs = SplitPaths(rest.substr(colon + 1));
+      if (inputs.empty()) {
+        LOG(ERROR) << "Invalid ninja build line: " << line;
+        return false;
+      }
+      build_rule = inputs[0];
+      vector<string>* list = &build.inputs;
+      for (int i = 1; i < inputs.size(); ++i) {
+        if (inputs[i] == "|") {
+          continue;  // implicit inputs are still inputs.
+        } else if (inputs[i] == "||") {
+          list = &build.order_only;
+        } else {
+          list->push_back(inputs[i]);
+        }
+      }
+      block = BUILD;
+    } else if (keyword == "default") {
+      vector<string> targets = SplitPaths(rest);
+      defaults_.insert(defaults_.end(), targets.begin(), targets.end());
+    } else if (keyword != "ninja_required_version") {
+      LOG(ERROR) << "Unexpected ninja line: " << line;
+      return false;
+    }
+  }
+  return finish_block();
+}
+
+int ActionGraph::Producer(const string& file) const {
+  auto it = producers_.find(file);
+  return (it == producers_.end() ? -1 : it->second);
+}
+
+int ActionGraph::PoolDepth(const string& pool) const {
+  auto it = pool_depth_.find(pool);
+  return (it == pool_depth_.end() ? 0 : it->second);
+}
+
+// static
+void ActionGraph::ReadDepfile(const string& depfile, vector<string>* inputs) {
+  std::ifstream in(depfile.c_str());
+  if (!in) {
+    return;
+  }
+  std::ostringstream contents;
+  contents << in.rdbuf();
+
+  // "target: dep dep \<newline> dep", then "-MP" adds "dep:" for each.
+  bool seen_target = false;
+  string current;
+  string text = contents.str() + "\n";
+  for (int i = 0; i < text.size(); ++i) {
+    char c = text[i];
+    if (c == '\\' && i + 1 < text.size() &&
+        (text[i + 1] == '\n' || text[i + 1] == ' ')) {
+      if (text[++i] == ' ') {
+        current += ' ';
+      }
+      continue;
+    }
+    if (c == ' ' || c == '\t' || c == '\n') {
+      if (!current.empty() && seen_target) {
+        inputs->push_back(current);
+      }
+      current.clear();
+      if (c == '\n' && seen_target) {
+        return;  // the rest are -MP's phony targets.
+      }
+      continue;
+    }
+    if (c == ':' && !seen_target &&
+        (i + 1 == text.size() || isspace(text[i + 1]))) {
+      seen_target = true;
+      current.clear();
+      continue;
+    }
+    current += c;
+  }
+}
+
+}  // namespace repobuild
@@ -0,0 +1,77 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// ActionGraph
+//  The actions of a build, read from the manifest that the ninja expansion
+//  writes (see generator/ninja.h): every make variable and function is
+//  expanded there, so each action is a plain shell command with its inputs
+//  and outputs. We only understand the subset of ninja that NinjaWriter
+//  writes.
+
+#ifndef _REPOBUILD_EXECUTOR_ACTION_GRAPH_H__
+#define _REPOBUILD_EXECUTOR_ACTION_GRAPH_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include "common/base/macros.h"
+
+namespace repobuild {
+
+class ActionGraph {
+ public:
+  struct Action {
+    Action() : restat(false), generator(false), cacheable(false) {}
+
+    std::vector<std::string> outputs;
+    std::vector<std::string> inputs;  // including ninja's implicit ones.
+    std::vector<std::string> order_only;
+    std::string command;  // empty for phony actions.
+    std::string depfile, pool;
+    // What the Makefile echoes for it, e.g. "Compiling" and the source.
+    std::string kind, label;
+    bool restat;
+    bool generator;  // rewrites the manifest itself.
+    // Hermetic: reads only 'inputs' (and the depfile's headers), writes
+    // only 'outputs' (see Makefile::Rule::SetCacheable).
+    bool cacheable;
+  };
+
+  ActionGraph() {}
+  ~ActionGraph() {}
+
+  // Returns false, and logs why, on anything we do not understand.
+  bool Parse(const std::string& manifest);
+
+  const std::vector<Action>& actions() const { return actions_; }
+  const std::vector<std::string>& defaults() const { return defaults_; }
+
+  // The action writing 'file', or -1 for a source file.
+  int Producer(const std::string& file) const;
+
+  // Ninja pool depth, 0 for unknown pools.
+  int PoolDepth(const std::string& pool) const;
+
+  // Reads the headers a compiler listed in 'depfile' ("-MMD"), adding them
+  // to 'inputs'. Missing depfiles are fine: the action has not run yet.
+  static void ReadDepfile(const std::string& depfile,
+                          std::vector<std::string>* inputs);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ActionGraph);
+
+  struct Rule {
+    Rule() : restat(false), generator(false) {}
+    std::string command, depfile;
+    bool restat, generator;
+  };
+
+  std::vector<Action> actions_;
+  std::vector<std::string> defaults_;
+  std::map<std::string, int> producers_;
+  std::map<std::string, int> pool_depth_;
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_EXECUTOR_ACTION_GRAPH_H__
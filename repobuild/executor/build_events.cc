@@ -0,0 +1,125 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <mutex>
+#include <string>
+#include "common/log/log.h"
+#include "common/strings/strutil.h"
+#include "repobuild/executor/build_events.h"
+#include "repobuild/third_party/json/json.h"
+
+using std::string;
+
+namespace repobuild {
+namespace {
+const char kSocketPrefix[] = "unix:";
+
+int ConnectUnixSocket(const string& path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  if (path.size() >= sizeof(address.sun_path)) {
+    LOG(ERROR) << "Socket path too long: " << path;
+    return -1;
+  }
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, reinterpret_cast<struct sockaddr*>(&address),
+                         sizeof(address)) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  if (fd < 0) {
+    LOG(ERROR) << "Could not connect to " << path << ": " << strerror(errno);
+    return -1;
+  }
+#ifdef SO_NOSIGPIPE
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  return fd;
+}
+}  // anonymous namespace
+
+// static
+BuildEventStream* BuildEventStream::Open(const string& destination) {
+  if (strings::HasPrefix(destination, kSocketPrefix)) {
+    int fd = ConnectUnixSocket(
+        destination.substr(sizeof(kSocketPrefix) - 1));
+    return (fd < 0 ? NULL : new BuildEventStream(fd, true));
+  }
+  int fd = open(destination.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not open " << destination << ": " << strerror(errno);
+    return NULL;
+  }
+  return new BuildEventStream(fd, false);
+}
+
+BuildEventStream::BuildEventStream(int fd, bool socket)
+    : fd_(fd),
+      socket_(socket),
+      failed_(false) {
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+  build_ = strings::StringPrintf("%s-%d-%lld", host, getpid(),
+                                 static_cast<long long>(NowMicros()));
+}
+
+BuildEventStream::~BuildEventStream() {
+  close(fd_);
+}
+
+// static
+int64_t BuildEventStream::NowMicros() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+void BuildEventStream::Write(const string& type, Json::Value event) {
+  event["event"] = type;
+  event["build"] = build_;
+  event["time_us"] = Json::Int64(NowMicros());
+  Json::FastWriter writer;
+  string line = writer.write(event);  // ends with a newline.
+
+  // One write per line, so concurrent writers to a file do not interleave.
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (failed_) {
+    return;
+  }
+  size_t written = 0;
+  while (written < line.size()) {
+    ssize_t size = 0;
+    if (socket_) {
+      int flags = 0;
+#ifdef MSG_NOSIGNAL
+      flags = MSG_NOSIGNAL;
+#endif
+      size = send(fd_, line.data() + written, line.size() - written, flags);
+    } else {
+      size = write(fd_, line.data() + written, line.size() - written);
+    }
+    if (size < 0 && errno == EINTR) {
+      continue;
+    }
+    if (size <= 0) {
+      LOG(WARNING) << "Could not write build events, dropping the rest: "
+                   << strerror(errno);
+      failed_ = true;
+      return;
+    }
+    written += size;
+  }
+}
+
+}  // namespace repobuild
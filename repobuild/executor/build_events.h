@@ -0,0 +1,62 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// BuildEventStream
+//  Machine readable events of a "repobuild build", for dashboards and
+//  regression alerts: one JSON object per line, appended to a file or sent
+//  to a listening Unix socket. Every event has "event", "build" (an id
+//  shared by the events of one build) and "time_us" (since the epoch):
+//    build_started    "targets", "actions" (how many the targets need).
+//    target_started   "target", when its first action starts.
+//    target_finished  "target", "success", "wall_us".
+//    action_started   "output" (its first), "kind" and "label" (what the
+//                     Makefile echoes, e.g. "Compiling" and the source),
+//                     "pool".
+//    cache_lookup     "output", "hit".
+//    action_finished  "output", "kind", "label", "where" (local, remote or
+//                     cache), "exit_status", "wall_us", "user_us",
+//                     "sys_us", "max_rss_kb" (local actions only) and
+//                     "outputs": [{"path", "size"}].
+//    test_result      "test" (the test binary), "passed", "wall_us".
+//    build_finished   "success", "wall_us", "actions_run".
+//  Fields may be added, so readers should ignore ones they do not know.
+
+#ifndef _REPOBUILD_EXECUTOR_BUILD_EVENTS_H__
+#define _REPOBUILD_EXECUTOR_BUILD_EVENTS_H__
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include "common/base/macros.h"
+#include "repobuild/third_party/json/json.h"
+
+namespace repobuild {
+
+class BuildEventStream {
+ public:
+  // 'destination' is a file, or unix:<path> for a Unix socket. Returns NULL
+  // (and logs why) if it cannot be opened.
+  static BuildEventStream* Open(const std::string& destination);
+  ~BuildEventStream();
+
+  // Writes 'event' with "event" set to 'type', and the common fields. Once
+  // a write fails, that is logged and the rest are dropped.
+  void Write(const std::string& type, Json::Value event);
+
+  static int64_t NowMicros();
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(BuildEventStream);
+
+  BuildEventStream(int fd, bool socket);
+
+  std::mutex mutex_;
+  int fd_;
+  bool socket_;
+  bool failed_;
+  std::string build_;
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_EXECUTOR_BUILD_EVENTS_H__
@@ -0,0 +1,176 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// A minimal cache server for "repobuild build --remote_cache=...", for
+// testing and small teams: the protocol of http_cache_store.h over a
+// DiskCacheStore. It only listens on the loopback interface unless told
+// otherwise with --listen, which then requires a --token_file: requests
+// without its token are refused, so nobody else can write entries that
+// clients restore into their trees. Traffic is not encrypted, so keep it on
+// a trusted network even so.
+//
+//  ./cache_server --dir=/var/cache/repobuild --port=8380
+//  repobuild build ":target" --remote_cache=http://localhost:8380
+//
+//  ./cache_server --dir=... --listen=:: --token_file=/etc/repobuild/token
+//  repobuild build ":target" --remote_cache=http://host:8380
+//      --remote_token_file=/etc/repobuild/token
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <thread>
+#include "common/base/flags.h"
+#include "common/base/init.h"
+#include "common/log/log.h"
+#include "common/strings/strutil.h"
+#include "repobuild/distsource/git_util.h"
+#include "repobuild/executor/cache_store.h"
+#include "repobuild/executor/http.h"
+
+using std::map;
+using std::string;
+
+DEFINE_string(dir, "",
+              "Where to keep the cache entries (see cache_store.h).");
+
+DEFINE_string(listen, "127.0.0.1",
+              "Address to listen on, e.g. :: for every interface.");
+
+DEFINE_int32(port, 8380,
+             "Port to listen on.");
+
+DEFINE_string(token_file, "",
+              "If set, only answer requests carrying the token in this file "
+              "(see --remote_token_file of repobuild). Required unless "
+              "--listen is a loopback address.");
+
+namespace {
+const char* kUsage =
+    "\n\n"
+    "  To serve a remote cache for repobuild build:\n"
+    "     cache_server --dir=/var/cache/repobuild [--port=8380] "
+    "[--listen=:: --token_file=path/to/token]\n"
+    "     repobuild build \"path/to/dir:target\" "
+    "--remote_cache=http://host:8380 [--remote_token_file=path/to/token]";
+
+string BlobId(const string& contents) {
+  repobuild::InitGitLibrary();
+  git_oid oid;
+  git_odb_hash(&oid, contents.data(), contents.size(), GIT_OBJ_BLOB);
+  return repobuild::GitOidString(&oid);
+}
+
+// Handles one request, returning the status and setting 'response'.
+int Handle(repobuild::DiskCacheStore* store,
+           const string& method,
+           const string& path,
+           const string& body,
+           string* response) {
+  if (method == "POST" && path == "/cas/missing") {
+    for (const string& id : strings::SplitString(body, "\n")) {
+      if (!id.empty() && !store->Contains("cas", id)) {
+        response->append(id + "\n");
+      }
+    }
+    return 200;
+  }
+
+  // /<kind>/<key>
+  size_t slash = path.find('/', 1);
+  if (path.empty() || path[0] != '/' || slash == string::npos) {
+    return 400;
+  }
+  string kind = path.substr(1, slash - 1);
+  string key = path.substr(slash + 1);
+  if (!repobuild::CacheStore::ValidEntry(kind, key)) {
+    return 400;
+  }
+  if (method == "GET") {
+    return (store->Get(kind, key, response) ? 200 : 404);
+  } else if (method == "PUT") {
+    if (kind == "cas" && BlobId(body) != key) {
+      return 400;  // cas entries are addressed by content.
+    }
+    return (store->Put(kind, key, body) ? 200 : 500);
+  }
+  return 405;
+}
+
+void Serve(repobuild::DiskCacheStore* store, const string& token, int fd) {
+  repobuild::HttpConnection connection(fd);
+  string request_line, body;
+  map<string, string> headers;
+  while (connection.Receive(&request_line, &headers, &body)) {
+    // "GET /cas/abcd HTTP/1.1"
+    size_t first = request_line.find(' ');
+    size_t second = request_line.find(' ', first + 1);
+    string response;
+    int status = 400;
+    if (!repobuild::HttpConnection::Authorized(headers, token)) {
+      status = 401;
+    } else if (first != string::npos && second != string::npos) {
+      status = Handle(store, request_line.substr(0, first),
+                      request_line.substr(first + 1, second - first - 1),
+                      body, &response);
+    }
+    VLOG(1) << request_line << " -> " << status;
+    map<string, string> response_headers;
+    bool close = (headers["connection"] == "close" || status == 401);
+    if (close) {
+      response_headers["connection"] = "close";
+    }
+    string reason = (status == 200 ? "OK" :
+                     status == 401 ? "Unauthorized" :
+                     status == 404 ? "Not Found" : "Error");
+    if (!connection.Send(strings::StringPrintf("HTTP/1.1 %d ", status) +
+                         reason, response_headers, response) ||
+        close) {
+      return;
+    }
+  }
+}
+}  // anonymous namespace
+
+int main(int argc, char** argv) {
+  InitProgram(&argc, &argv, kUsage, true);
+  if (FLAGS_dir.empty()) {
+    LOG(FATAL) << "--dir is required.";
+  }
+  signal(SIGPIPE, SIG_IGN);
+  if (FLAGS_token_file.empty() &&
+      !repobuild::HttpConnection::IsLoopback(FLAGS_listen)) {
+    LOG(ERROR) << "--listen=" << FLAGS_listen << " requires --token_file.";
+    return 1;
+  }
+  string token;
+  if (!FLAGS_token_file.empty() &&
+      !repobuild::ReadTokenFile(FLAGS_token_file, &token)) {
+    return 1;
+  }
+  repobuild::DiskCacheStore store(FLAGS_dir);
+
+  int listener = repobuild::HttpConnection::Listen(FLAGS_listen, FLAGS_port);
+  if (listener < 0) {
+    return 1;
+  }
+  LOG(INFO) << "Serving " << FLAGS_dir << " on " << FLAGS_listen
+            << " port " << FLAGS_port;
+
+  while (true) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EINTR) {
+        LOG(WARNING) << "accept: " << strerror(errno);
+      }
+      continue;
+    }
+    std::thread(Serve, &store, token, fd).detach();
+  }
+  return 0;
+}
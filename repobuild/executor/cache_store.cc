@@ -0,0 +1,139 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "common/log/log.h"
+#include "common/strings/path.h"
+#include "common/strings/strutil.h"
+#include "repobuild/executor/cache_store.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace repobuild {
+namespace {
+void MakeDirs(const string& dir) {
+  if (dir.empty() || dir == "." || dir == "/") {
+    return;
+  }
+  struct stat dir_stat;
+  if (stat(dir.c_str(), &dir_stat) == 0) {
+    return;
+  }
+  MakeDirs(strings::PathDirname(dir));
+  mkdir(dir.c_str(), 0777);  // may race with another build, which is fine.
+}
+}  // anonymous namespace
+
+// static
+bool CacheStore::ValidEntry(const string& kind, const string& key) {
+  if (kind != "cas" && kind != "ac" && kind != "deps") {
+    return false;
+  }
+  if (key.size() < 3) {
+    return false;
+  }
+  for (char c : key) {
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void CacheStore::GetBlobs(const vector<string>& ids,
+                          map<string, string>* blobs) {
+  for (const string& id : ids) {
+    string contents;
+    if (Get("cas", id, &contents)) {
+      (*blobs)[id] = contents;
+    }
+  }
+}
+
+void CacheStore::PutBlobs(const map<string, string>& blobs) {
+  for (const auto& it : blobs) {
+    Put("cas", it.first, it.second);
+  }
+}
+
+DiskCacheStore::DiskCacheStore(const string& dir)
+    : dir_(dir) {
+}
+
+DiskCacheStore::~DiskCacheStore() {
+}
+
+string DiskCacheStore::Path(const string& kind, const string& key) const {
+  return strings::JoinPath(dir_, strings::JoinPath(
+      kind, strings::JoinPath(key.substr(0, 2), key.substr(2))));
+}
+
+bool DiskCacheStore::Get(const string& kind, const string& key,
+                         string* contents) {
+  if (!ValidEntry(kind, key)) {
+    return false;
+  }
+  std::ifstream in(Path(kind, key).c_str(), std::ios::in | std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  std::ostringstream out;
+  out << in.rdbuf();
+  *contents = out.str();
+  return !in.bad();
+}
+
+bool DiskCacheStore::Contains(const string& kind, const string& key) const {
+  return ValidEntry(kind, key) && access(Path(kind, key).c_str(), F_OK) == 0;
+}
+
+bool DiskCacheStore::Put(const string& kind, const string& key,
+                         const string& contents) {
+  if (!ValidEntry(kind, key)) {
+    return false;
+  }
+  if (kind == "cas" && Contains(kind, key)) {
+    return true;  // same id, same contents.
+  }
+  return WriteAtomically(Path(kind, key), contents, false);
+}
+
+// static
+bool DiskCacheStore::WriteAtomically(const string& path,
+                                     const string& contents,
+                                     bool executable) {
+  MakeDirs(strings::PathDirname(path));
+  static std::atomic<int> counter(0);
+  string tmp = strings::StringPrintf("%s.tmp.%d.%d", path.c_str(), getpid(),
+                                     counter++);
+  {
+    std::ofstream out(tmp.c_str(), std::ios::out | std::ios::binary);
+    out << contents;
+    if (!out) {
+      LOG(WARNING) << "Could not write " << tmp << ": " << strerror(errno);
+      unlink(tmp.c_str());
+      return false;
+    }
+  }
+  if ((executable && chmod(tmp.c_str(), 0755) != 0) ||
+      rename(tmp.c_str(), path.c_str()) != 0) {
+    LOG(WARNING) << "Could not write " << path << ": " << strerror(errno);
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace repobuild
@@ -0,0 +1,78 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// CacheStore
+//  Where an ActionCache keeps its entries. Each entry is a kind and a hex
+//  key:
+//    cas/<blob id>  file contents, by git blob id.
+//    ac/<key>       outputs of an action (see action_cache.h).
+//    deps/<key>     headers of an action.
+//  DiskCacheStore keeps them in a directory, HttpCacheStore (see
+//  http_cache_store.h) on a cache server.
+
+#ifndef _REPOBUILD_EXECUTOR_CACHE_STORE_H__
+#define _REPOBUILD_EXECUTOR_CACHE_STORE_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include "common/base/macros.h"
+
+namespace repobuild {
+
+class CacheStore {
+ public:
+  CacheStore() {}
+  virtual ~CacheStore() {}
+
+  // True for the kinds above, and keys that are plain hex.
+  static bool ValidEntry(const std::string& kind, const std::string& key);
+
+  // Returns false if there is no such entry (or it cannot be read).
+  virtual bool Get(const std::string& kind, const std::string& key,
+                   std::string* contents) = 0;
+  virtual bool Put(const std::string& kind, const std::string& key,
+                   const std::string& contents) = 0;
+
+  // Adds the blobs in 'ids' we have to 'blobs' (id -> contents).
+  virtual void GetBlobs(const std::vector<std::string>& ids,
+                        std::map<std::string, std::string>* blobs);
+
+  // Stores 'blobs' (id -> contents), skipping the ones we already have.
+  virtual void PutBlobs(const std::map<std::string, std::string>& blobs);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(CacheStore);
+};
+
+class DiskCacheStore : public CacheStore {
+ public:
+  // 'dir' may be shared (e.g. over NFS) by any number of builds, since
+  // every file is written under a temporary name and renamed into place.
+  explicit DiskCacheStore(const std::string& dir);
+  virtual ~DiskCacheStore();
+
+  virtual bool Get(const std::string& kind, const std::string& key,
+                   std::string* contents);
+  virtual bool Put(const std::string& kind, const std::string& key,
+                   const std::string& contents);
+
+  bool Contains(const std::string& kind, const std::string& key) const;
+
+  // Writes 'contents' to 'path' (creating its directory) under a temporary
+  // name, then renames it.
+  static bool WriteAtomically(const std::string& path,
+                              const std::string& contents,
+                              bool executable);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(DiskCacheStore);
+
+  std::string Path(const std::string& kind, const std::string& key) const;
+
+  std::string dir_;
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_EXECUTOR_CACHE_STORE_H__
@@ -0,0 +1,574 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <errno.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "common/log/log.h"
+#include "repobuild/executor/action_cache.h"
+#include "repobuild/executor/action_graph.h"
+#include "repobuild/executor/build_events.h"
+#include "repobuild/executor/executor.h"
+#include "repobuild/executor/remote_executor.h"
+#include "repobuild/generator/action_log.h"
+#include "repobuild/third_party/json/json.h"
+
+extern char** environ;
+
+using std::set;
+using std::string;
+using std::vector;
+
+namespace repobuild {
+namespace {
+int64_t Micros(const struct timeval& tv) {
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+int64_t Now() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return Micros(now) * 1000;
+}
+}  // anonymous namespace
+
+Executor::Executor(const ActionGraph* graph, int num_threads)
+    : graph_(graph),
+      cache_(NULL),
+      remote_(NULL),
+      events_(NULL),
+      states_(graph->actions().size()),
+      failed_(false),
+      ran_(0),
+      pool_(num_threads) {
+}
+
+Executor::~Executor() {
+}
+
+int64_t Executor::Mtime(const string& path) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = mtimes_.find(path);
+    if (it != mtimes_.end()) {
+      return it->second;
+    }
+  }
+  struct stat file_stat;
+  int64_t mtime = -1;
+  if (stat(path.c_str(), &file_stat) == 0) {
+#ifdef __APPLE__
+    mtime = (file_stat.st_mtimespec.tv_sec * 1000000000LL +
+             file_stat.st_mtimespec.tv_nsec);
+#else
+    mtime = (file_stat.st_mtim.tv_sec * 1000000000LL +
+             file_stat.st_mtim.tv_nsec);
+#endif
+  }
+  SetMtime(path, mtime);
+  return mtime;
+}
+
+void Executor::SetMtime(const string& path, int64_t mtime) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  mtimes_[path] = mtime;
+}
+
+bool Executor::NeedsRegeneration() {
+  for (int i = 0; i < graph_->actions().size(); ++i) {
+    const ActionGraph::Action& action = graph_->actions()[i];
+    bool dirty = false;
+    if (action.generator && IsDirty(i, &dirty) && dirty) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Executor::Build(const vector<string>& targets) {
+  CHECK_EQ(graph_->actions().size(), states_.size())
+      << "Create the Executor after parsing its graph.";
+
+  // Everything the targets need.
+  vector<int> stack;
+  for (const string& target : targets) {
+    int producer = graph_->Producer(target);
+    if (producer >= 0) {
+      stack.push_back(producer);
+    } else if (Mtime(target) < 0) {
+      LOG(ERROR) << "No action writes " << target;
+      return false;
+    }
+  }
+  vector<int> needed;
+  while (!stack.empty()) {
+    int index = stack.back();
+    stack.pop_back();
+    if (states_[index].needed) {
+      continue;
+    }
+    states_[index].needed = true;
+    needed.push_back(index);
+
+    const ActionGraph::Action& action = graph_->actions()[index];
+    set<int> producers;
+    for (const vector<string>* files : { &action.inputs,
+                                         &action.order_only }) {
+      for (const string& file : *files) {
+        int producer = graph_->Producer(file);
+        if (producer >= 0 && producer != index &&
+            producers.insert(producer).second) {
+          states_[producer].dependents.push_back(index);
+          stack.push_back(producer);
+        }
+      }
+    }
+    states_[index].waiting = producers.size();
+  }
+
+  SetPriorities(needed);
+
+  int64_t start_us = BuildEventStream::NowMicros();
+  if (events_ != NULL) {
+    Json::Value event(Json::objectValue);
+    event["targets"] = Json::Value(Json::arrayValue);
+    for (const string& target : targets) {
+      event["targets"].append(target);
+      int producer = graph_->Producer(target);
+      if (producer >= 0) {
+        AddTarget(target, producer);
+      }
+    }
+    int actions = 0;
+    for (int index : needed) {
+      if (!graph_->actions()[index].command.empty()) {
+        ++actions;
+      }
+    }
+    event["actions"] = actions;
+    events_->Write("build_started", event);
+  }
+
+  // Start whatever is ready; each action starts its dependents. Those may
+  // finish before we are done scheduling, so decide what is ready first.
+  vector<int> ready;
+  for (int index : needed) {
+    if (states_[index].waiting == 0) {
+      ready.push_back(index);
+    }
+  }
+  Ready(ready);
+  pool_.Wait();
+
+  if (events_ != NULL) {
+    for (int i = 0; i < targets_.size(); ++i) {
+      if (!targets_[i].finished) {
+        TargetFinished(i, false);
+      }
+    }
+    Json::Value event(Json::objectValue);
+    event["success"] = !failed_;
+    event["wall_us"] = Json::Int64(BuildEventStream::NowMicros() - start_us);
+    event["actions_run"] = ran_;
+    events_->Write("build_finished", event);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (ran_ == 0 && !failed_) {
+    std::cout << "Nothing to be done." << std::endl;
+  }
+  return !failed_;
+}
+
+void Executor::AddTarget(const string& target, int action) {
+  int index = targets_.size();
+  targets_.push_back(TargetState());
+  targets_.back().name = target;
+  targets_.back().action = action;
+
+  // Every action it needs reports to it.
+  vector<bool> seen(states_.size());
+  vector<int> stack(1, action);
+  seen[action] = true;
+  while (!stack.empty()) {
+    int current = stack.back();
+    stack.pop_back();
+    states_[current].targets.push_back(index);
+    const ActionGraph::Action& action = graph_->actions()[current];
+    for (const vector<string>* files : { &action.inputs,
+                                         &action.order_only }) {
+      for (const string& file : *files) {
+        int producer = graph_->Producer(file);
+        if (producer >= 0 && !seen[producer]) {
+          seen[producer] = true;
+          stack.push_back(producer);
+        }
+      }
+    }
+  }
+}
+
+void Executor::SetPriorities(const vector<int>& needed) {
+  int64_t total = 0;
+  int known = 0;
+  for (int index : needed) {
+    const ActionGraph::Action& action = graph_->actions()[index];
+    auto it = durations_.find(action.outputs[0]);
+    if (it != durations_.end() && !action.command.empty()) {
+      total += it->second;
+      ++known;
+    }
+  }
+  int64_t default_duration = (known > 0 ? total / known : 1);
+  for (int index : needed) {
+    Priority(index, default_duration);
+  }
+}
+
+int64_t Executor::Priority(int index, int64_t default_duration) {
+  ActionState* state = &states_[index];
+  if (state->priority >= 0) {
+    return state->priority;
+  }
+  const ActionGraph::Action& action = graph_->actions()[index];
+  int64_t duration = 0;
+  if (!action.command.empty()) {
+    auto it = durations_.find(action.outputs[0]);
+    duration = (it != durations_.end() ? it->second : default_duration);
+  }
+  int64_t longest_after = 0;
+  for (int dependent : state->dependents) {
+    if (states_[dependent].needed) {
+      longest_after = std::max(longest_after,
+                               Priority(dependent, default_duration));
+    }
+  }
+  state->priority = duration + longest_after;
+  return state->priority;
+}
+
+void Executor::Ready(const vector<int>& actions) {
+  // All of them go in before any runs, so the first gets no head start.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int index : actions) {
+      ready_.push(std::make_pair(states_[index].priority, index));
+    }
+  }
+  for (int i = 0; i < actions.size(); ++i) {
+    pool_.Schedule([this]() { RunNext(); });
+  }
+}
+
+void Executor::RunNext() {
+  int index = -1;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index = ready_.top().second;
+    ready_.pop();
+  }
+  Check(index);
+}
+
+void Executor::Check(int index) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (failed_) {
+      return;
+    }
+  }
+  const ActionGraph::Action& action = graph_->actions()[index];
+  bool dirty = false;
+  if (!IsDirty(index, &dirty)) {
+    Finish(index, false);
+    return;
+  }
+  if (!dirty) {
+    Finish(index, true);
+    return;
+  }
+
+  int depth = graph_->PoolDepth(action.pool);
+  if (depth > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pool_running_[action.pool] >= depth) {
+      pool_waiting_[action.pool].push(
+          std::make_pair(states_[index].priority, index));
+      return;
+    }
+    ++pool_running_[action.pool];
+  }
+  Start(index);
+}
+
+void Executor::Start(int index) {
+  const ActionGraph::Action& action = graph_->actions()[index];
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++ran_;
+  }
+  if (events_ != NULL) {
+    ActionStarted(index);
+  }
+  ActionLog::Action record;
+  record.start_us = BuildEventStream::NowMicros();
+  record.target = action.outputs[0];
+  record.make_pid = getpid();
+
+  string where = "local";
+  bool cached = false;
+  if (cache_ != NULL && action.cacheable) {
+    cached = cache_->Restore(action);
+    if (events_ != NULL) {
+      Json::Value event(Json::objectValue);
+      event["output"] = action.outputs[0];
+      event["hit"] = cached;
+      events_->Write("cache_lookup", event);
+    }
+  }
+  int status = 0;
+  if (cached) {
+    where = "cache";
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::cout << "Cached: " << action.outputs[0] << std::endl;
+  } else if (remote_ != NULL && action.cacheable && remote_->Run(action)) {
+    where = "remote";
+  } else {
+    status = RunCommand(index, &record);
+  }
+  record.wall_us = BuildEventStream::NowMicros() - record.start_us;
+  record.exit_status = status;
+  if (!cached && !log_file_.empty()) {
+    ActionLog::Append(log_file_, record);
+  }
+  if (!cached && status == 0 && cache_ != NULL && action.cacheable) {
+    cache_->Store(action);
+  }
+  if (status != 0) {
+    LOG(ERROR) << "FAILED (exit " << status << "): "
+               << action.outputs[0] << "\n" << action.command;
+  }
+
+  // Leftover outputs, and ones we never write (e.g. "tests"), count as new.
+  int64_t now = Now();
+  for (const string& output : action.outputs) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      mtimes_.erase(output);  // stat it again.
+    }
+    if (Mtime(output) < 0) {
+      SetMtime(output, now);
+    }
+  }
+  if (events_ != NULL) {
+    ActionFinished(index, where, record);
+  }
+
+  if (graph_->PoolDepth(action.pool) > 0) {
+    int next = -1;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ReadyQueue* waiting = &pool_waiting_[action.pool];
+      if (!waiting->empty() && !failed_ && status == 0) {
+        next = waiting->top().second;
+        waiting->pop();
+      } else {
+        --pool_running_[action.pool];
+      }
+    }
+    if (next >= 0) {
+      pool_.Schedule([this, next]() { Start(next); });
+    }
+  }
+  Finish(index, status == 0);
+}
+
+bool Executor::IsDirty(int index, bool* dirty) {
+  const ActionGraph::Action& action = graph_->actions()[index];
+  vector<string> inputs = action.inputs;
+  if (!action.depfile.empty()) {
+    ActionGraph::ReadDepfile(action.depfile, &inputs);
+  }
+  int64_t newest_input = -1;
+  for (int i = 0; i < inputs.size(); ++i) {
+    int64_t mtime = Mtime(inputs[i]);
+    if (mtime < 0 && graph_->Producer(inputs[i]) < 0) {
+      // Headers from the depfile may have been removed since, which just
+      // means the compile is out of date.
+      if (i >= action.inputs.size()) {
+        *dirty = true;
+        continue;
+      }
+      LOG(ERROR) << "Missing " << inputs[i] << ", needed by "
+                 << action.outputs[0];
+      return false;
+    }
+    newest_input = std::max(newest_input, mtime);
+  }
+
+  if (action.command.empty()) {
+    // Phony: as new as its newest input.
+    for (const string& output : action.outputs) {
+      SetMtime(output, std::max<int64_t>(newest_input, 0));
+    }
+    *dirty = false;
+    return true;
+  }
+  for (const string& output : action.outputs) {
+    int64_t mtime = Mtime(output);
+    if (mtime < 0 || mtime < newest_input) {
+      *dirty = true;
+    }
+  }
+  return true;
+}
+
+int Executor::RunCommand(int index, ActionLog::Action* record) {
+  const ActionGraph::Action& action = graph_->actions()[index];
+  const char* argv[] = { "/bin/sh", "-c", action.command.c_str(), NULL };
+  pid_t pid;
+  if (posix_spawn(&pid, argv[0], NULL, NULL, const_cast<char**>(argv),
+                  environ) != 0) {
+    LOG(ERROR) << "Could not run /bin/sh: " << strerror(errno);
+    return 127;
+  }
+  int status = 0;
+  struct rusage usage;
+  while (wait4(pid, &status, 0, &usage) < 0) {
+    if (errno != EINTR) {
+      LOG(ERROR) << "wait4: " << strerror(errno);
+      return 127;
+    }
+  }
+  record->user_us = Micros(usage.ru_utime);
+  record->sys_us = Micros(usage.ru_stime);
+  record->max_rss_kb = usage.ru_maxrss;
+#ifdef __APPLE__
+  record->max_rss_kb /= 1024;
+#endif
+  return (WIFEXITED(status) ? WEXITSTATUS(status) :
+          128 + WTERMSIG(status));
+}
+
+void Executor::Finish(int index, bool success) {
+  if (events_ != NULL) {
+    for (int target : states_[index].targets) {
+      if (targets_[target].action == index) {
+        TargetFinished(target, success);
+      }
+    }
+  }
+  vector<int> ready;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!success) {
+      failed_ = true;
+      return;
+    }
+    for (int dependent : states_[index].dependents) {
+      if (states_[dependent].needed && --states_[dependent].waiting == 0) {
+        ready.push_back(dependent);
+      }
+    }
+  }
+  Ready(ready);
+}
+
+void Executor::ActionStarted(int index) {
+  const ActionGraph::Action& action = graph_->actions()[index];
+  int64_t now = BuildEventStream::NowMicros();
+  vector<string> started;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int target : states_[index].targets) {
+      if (!targets_[target].started) {
+        targets_[target].started = true;
+        targets_[target].start_us = now;
+        started.push_back(targets_[target].name);
+      }
+    }
+  }
+  for (const string& target : started) {
+    Json::Value event(Json::objectValue);
+    event["target"] = target;
+    events_->Write("target_started", event);
+  }
+  Json::Value event(Json::objectValue);
+  event["output"] = action.outputs[0];
+  event["kind"] = action.kind;
+  event["label"] = action.label;
+  event["pool"] = action.pool;
+  events_->Write("action_started", event);
+}
+
+void Executor::ActionFinished(int index, const string& where,
+                              const ActionLog::Action& record) {
+  const ActionGraph::Action& action = graph_->actions()[index];
+  Json::Value event(Json::objectValue);
+  event["output"] = action.outputs[0];
+  event["kind"] = action.kind;
+  event["label"] = action.label;
+  event["where"] = where;
+  event["exit_status"] = record.exit_status;
+  event["wall_us"] = Json::Int64(record.wall_us);
+  if (where == "local") {
+    event["user_us"] = Json::Int64(record.user_us);
+    event["sys_us"] = Json::Int64(record.sys_us);
+    event["max_rss_kb"] = Json::Int64(record.max_rss_kb);
+  }
+  event["outputs"] = Json::Value(Json::arrayValue);
+  for (const string& output : action.outputs) {
+    struct stat file_stat;
+    if (stat(output.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+      Json::Value file(Json::objectValue);
+      file["path"] = output;
+      file["size"] = Json::Int64(file_stat.st_size);
+      event["outputs"].append(file);
+    }
+  }
+  events_->Write("action_finished", event);
+
+  if (action.kind == "Testing") {
+    Json::Value test(Json::objectValue);
+    test["test"] = action.label;
+    test["passed"] = (record.exit_status == 0);
+    test["wall_us"] = Json::Int64(record.wall_us);
+    events_->Write("test_result", test);
+  }
+}
+
+void Executor::TargetFinished(int target, bool success) {
+  int64_t now = BuildEventStream::NowMicros();
+  Json::Value event(Json::objectValue);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    TargetState* state = &targets_[target];
+    if (state->finished) {
+      return;
+    }
+    state->finished = true;
+    if (!state->started) {
+      state->start_us = now;  // nothing to do.
+    }
+    event["target"] = state->name;
+    event["wall_us"] = Json::Int64(now - state->start_us);
+  }
+  event["success"] = success;
+  events_->Write("target_finished", event);
+}
+
+}  // namespace repobuild
@@ -0,0 +1,156 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// Executor
+//  Runs the actions of an ActionGraph directly instead of through make.
+//  Each action is started on a WorkerPool as soon as the actions writing
+//  its inputs are done. Modification times are read at most once and then
+//  tracked in memory.
+//
+//  Like make, an action runs if an output is missing or older than one of
+//  its inputs (including the headers in its depfile). Outputs are stat'ed
+//  again after running, so actions that leave them alone (see restat) do not
+//  rebuild their dependents.
+//
+//  Of the actions that are ready, the one with the longest estimated path to
+//  the end of the build starts first, using how long each action took last
+//  time (see SetDurations), so long poles like big links are never stuck
+//  behind a queue of small compiles.
+//
+//  With an ActionCache, out of date cacheable actions (compiles and links,
+//  see ActionGraph::Action) first try to restore their outputs from it, and
+//  store them after running otherwise. With a RemoteExecutor, the cacheable
+//  actions it can take run on remote workers. With a
+//  BuildEventStream, each step is reported as it happens.
+
+#ifndef _REPOBUILD_EXECUTOR_EXECUTOR_H__
+#define _REPOBUILD_EXECUTOR_EXECUTOR_H__
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+#include "common/base/macros.h"
+#include "repobuild/distsource/worker_pool.h"
+#include "repobuild/generator/action_log.h"
+
+namespace repobuild {
+
+class ActionCache;
+class ActionGraph;
+class BuildEventStream;
+class RemoteExecutor;
+
+class Executor {
+ public:
+  // 'graph' is not owned, and must already be parsed.
+  Executor(const ActionGraph* graph, int num_threads);
+  ~Executor();
+
+  // Also append what each action took to 'log_file' (see
+  // generator/action_log.h).
+  void SetActionLog(const std::string& log_file) { log_file_ = log_file; }
+
+  // Wall time of previous runs of each action, by its first output (see
+  // ActionLog::LatestDurations). Actions we have no time for are assumed to
+  // take the average.
+  void SetDurations(const std::map<std::string, int64_t>& durations) {
+    durations_ = durations;
+  }
+
+  // 'cache' is not owned, and may be NULL (the default) to always run.
+  void SetActionCache(ActionCache* cache) { cache_ = cache; }
+
+  // 'remote' is not owned, and may be NULL (the default) to run locally.
+  void SetRemoteExecutor(RemoteExecutor* remote) { remote_ = remote; }
+
+  // 'events' is not owned, and may be NULL (the default).
+  void SetEventStream(BuildEventStream* events) { events_ = events; }
+
+  // True if an action that rewrites the manifest itself is out of date.
+  bool NeedsRegeneration();
+
+  // Brings the files in 'targets' up to date. After a failure, waits for
+  // the running actions and returns false.
+  bool Build(const std::vector<std::string>& targets);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(Executor);
+
+  struct ActionState {
+    ActionState() : needed(false), waiting(0), priority(-1) {}
+
+    bool needed;
+    int waiting;  // unfinished actions writing our inputs.
+    int64_t priority;  // remaining critical path, in microseconds.
+    std::vector<int> dependents;
+    std::vector<int> targets;  // of targets_ needing it, with events_.
+  };
+
+  struct TargetState {
+    TargetState() : action(-1), started(false), finished(false), start_us(0) {}
+
+    std::string name;
+    int action;  // writing it.
+    bool started, finished;
+    int64_t start_us;
+  };
+
+  // Modification time in nanoseconds, -1 if missing.
+  int64_t Mtime(const std::string& path);
+  void SetMtime(const std::string& path, int64_t mtime);
+
+  // Estimates, from durations_, how long from the start of 'action' the
+  // build has to take at least.
+  void SetPriorities(const std::vector<int>& needed);
+  int64_t Priority(int action, int64_t default_duration);
+
+  // Queues 'actions' to be checked, highest priority first: each pool
+  // closure runs whichever ready action is on top (RunNext).
+  void Ready(const std::vector<int>& actions);
+  void RunNext();
+
+  // Run as pool closures.
+  void Check(int action);  // runs the action if it is out of date.
+  void Start(int action);
+
+  // Returns false if an input is missing with nothing to write it.
+  bool IsDirty(int action, bool* dirty);
+  // Returns the exit status, filling in the resources 'record' used.
+  int RunCommand(int action, ActionLog::Action* record);
+  void Finish(int action, bool success);
+
+  // Build events.
+  void AddTarget(const std::string& target, int action);
+  void ActionStarted(int action);
+  void ActionFinished(int action, const std::string& where,
+                      const ActionLog::Action& record);
+  void TargetFinished(int target, bool success);
+
+  const ActionGraph* graph_;
+  ActionCache* cache_;
+  RemoteExecutor* remote_;
+  BuildEventStream* events_;
+  std::string log_file_;
+  std::map<std::string, int64_t> durations_;
+  std::vector<ActionState> states_;
+  std::vector<TargetState> targets_;
+
+  std::mutex mutex_;
+  std::map<std::string, int64_t> mtimes_;
+  typedef std::priority_queue<std::pair<int64_t, int> > ReadyQueue;
+  ReadyQueue ready_;
+  std::map<std::string, int> pool_running_;
+  std::map<std::string, ReadyQueue> pool_waiting_;
+  bool failed_;
+  int ran_;
+
+  WorkerPool pool_;  // last, so it is joined first.
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_EXECUTOR_EXECUTOR_H__
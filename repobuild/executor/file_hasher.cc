@@ -0,0 +1,60 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <mutex>
+#include <string>
+#include "repobuild/distsource/dist_source.h"
+#include "repobuild/distsource/git_util.h"
+#include "repobuild/executor/file_hasher.h"
+
+using std::string;
+
+namespace repobuild {
+
+// static
+string FileHasher::HashString(const string& data) {
+  InitGitLibrary();
+  git_oid oid;
+  git_odb_hash(&oid, data.data(), data.size(), GIT_OBJ_BLOB);
+  return GitOidString(&oid);
+}
+
+bool FileHasher::HashFile(const string& path, string* id) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+    return false;
+  }
+#ifdef __APPLE__
+  int64_t mtime = (file_stat.st_mtimespec.tv_sec * 1000000000LL +
+                   file_stat.st_mtimespec.tv_nsec);
+#else
+  int64_t mtime = (file_stat.st_mtim.tv_sec * 1000000000LL +
+                   file_stat.st_mtim.tv_nsec);
+#endif
+  std::pair<int64_t, int64_t> version(mtime, file_stat.st_size);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = ids_.find(path);
+    if (it != ids_.end() && it->second.first == version) {
+      *id = it->second.second;
+      return true;
+    }
+  }
+  // Only dirty and untracked files are hashed by either.
+  if (source_ == NULL || path[0] == '/' ||
+      !source_->FileFingerprint(path, id)) {
+    InitGitLibrary();
+    git_oid oid;
+    if (git_odb_hashfile(&oid, path.c_str(), GIT_OBJ_BLOB) != 0) {
+      return false;
+    }
+    *id = GitOidString(&oid);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  ids_[path] = std::make_pair(version, *id);
+  return true;
+}
+
+}  // namespace repobuild
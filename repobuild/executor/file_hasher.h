@@ -0,0 +1,53 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// FileHasher
+//  Git blob ids of files, which is how the action cache and remote workers
+//  address contents. Ids are remembered by mtime and size, since many
+//  actions read the same headers. With a DistSource, source files it can
+//  vouch for (e.g. clean in the git index) are not read at all. Thread
+//  safe.
+
+#ifndef _REPOBUILD_EXECUTOR_FILE_HASHER_H__
+#define _REPOBUILD_EXECUTOR_FILE_HASHER_H__
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include "common/base/macros.h"
+
+namespace repobuild {
+
+class DistSource;
+
+class FileHasher {
+ public:
+  FileHasher() : source_(NULL) {}
+  ~FileHasher() {}
+
+  // Paths relative to the root (our working directory) are fingerprinted
+  // by 'source' first, see DistSource::FileFingerprint. Not owned, may be
+  // NULL (the default).
+  void SetDistSource(DistSource* source) { source_ = source; }
+
+  static std::string HashString(const std::string& data);
+
+  // Returns false if 'path' is missing or not a file.
+  bool HashFile(const std::string& path, std::string* id);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(FileHasher);
+
+  DistSource* source_;
+
+  std::mutex mutex_;
+  // path -> ((mtime, size), id).
+  std::map<std::string, std::pair<std::pair<int64_t, int64_t>, std::string> >
+      ids_;
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_EXECUTOR_FILE_HASHER_H__
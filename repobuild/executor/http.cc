@@ -0,0 +1,443 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include "common/log/log.h"
+#include "common/strings/strutil.h"
+#include "repobuild/executor/http.h"
+
+using std::map;
+using std::string;
+
+namespace repobuild {
+namespace {
+// Bounds a stuck peer, not a slow transfer: this is per read or write.
+const int kTimeoutSeconds = 60;
+
+// Largest header block and body we accept.
+const int kMaxHeaderBytes = 64 << 10;
+const size_t kMaxBodyBytes = 1 << 30;
+
+// Carries the shared secret, see HttpClient::SetToken.
+const char kTokenHeader[] = "x-repobuild-token";
+
+string Lower(const string& value) {
+  string out = value;
+  for (int i = 0; i < out.size(); ++i) {
+    out[i] = tolower(out[i]);
+  }
+  return out;
+}
+
+string Trim(const string& value) {
+  size_t start = value.find_first_not_of(" \t");
+  if (start == string::npos) {
+    return "";
+  }
+  size_t end = value.find_last_not_of(" \t\r");
+  return value.substr(start, end + 1 - start);
+}
+}  // anonymous namespace
+
+HttpConnection::HttpConnection(int fd)
+    : fd_(fd) {
+  struct timeval timeout;
+  timeout.tv_sec = kTimeoutSeconds;
+  timeout.tv_usec = 0;
+  setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+  int one = 1;
+  setsockopt(fd_, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+HttpConnection::~HttpConnection() {
+  close(fd_);
+}
+
+// static
+HttpConnection* HttpConnection::Connect(const string& host, int port) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addresses = NULL;
+  string service = strings::StringPrintf("%d", port);
+  int error = getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses);
+  if (error != 0) {
+    LOG(WARNING) << "Could not resolve " << host << ": "
+                 << gai_strerror(error);
+    return NULL;
+  }
+  int fd = -1;
+  for (struct addrinfo* address = addresses; address != NULL;
+       address = address->ai_next) {
+    fd = socket(address->ai_family, address->ai_socktype,
+                address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    LOG(WARNING) << "Could not connect to " << host << ":" << port << ": "
+                 << strerror(errno);
+    return NULL;
+  }
+  return new HttpConnection(fd);
+}
+
+// static
+int HttpConnection::Listen(const string& address, int port) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  struct addrinfo* addresses = NULL;
+  string service = strings::StringPrintf("%d", port);
+  int error = getaddrinfo(address.c_str(), service.c_str(), &hints,
+                          &addresses);
+  if (error != 0) {
+    LOG(WARNING) << "Could not resolve " << address << ": "
+                 << gai_strerror(error);
+    return -1;
+  }
+  int fd = -1;
+  error = 0;
+  for (struct addrinfo* entry = addresses; entry != NULL;
+       entry = entry->ai_next) {
+    fd = socket(entry->ai_family, entry->ai_socktype, entry->ai_protocol);
+    if (fd < 0) {
+      error = errno;
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (entry->ai_family == AF_INET6) {
+      int zero = 0;  // so :: takes IPv4 as well.
+      setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+    }
+    if (bind(fd, entry->ai_addr, entry->ai_addrlen) == 0 &&
+        listen(fd, 128) == 0) {
+      break;
+    }
+    error = errno;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    LOG(WARNING) << "Could not listen on " << address << " port " << port
+                 << ": " << strerror(error);
+  }
+  return fd;
+}
+
+// static
+bool HttpConnection::IsLoopback(const string& address) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  struct addrinfo* addresses = NULL;
+  if (getaddrinfo(address.c_str(), NULL, &hints, &addresses) != 0) {
+    return false;
+  }
+  bool loopback = (addresses != NULL);
+  for (struct addrinfo* entry = addresses; entry != NULL;
+       entry = entry->ai_next) {
+    if (entry->ai_family == AF_INET) {
+      const struct sockaddr_in* ip =
+          reinterpret_cast<const struct sockaddr_in*>(entry->ai_addr);
+      loopback &= ((ntohl(ip->sin_addr.s_addr) >> 24) == 127);
+    } else if (entry->ai_family == AF_INET6) {
+      const struct sockaddr_in6* ip =
+          reinterpret_cast<const struct sockaddr_in6*>(entry->ai_addr);
+      loopback &= (IN6_IS_ADDR_LOOPBACK(&ip->sin6_addr) != 0);
+    } else {
+      loopback = false;
+    }
+  }
+  freeaddrinfo(addresses);
+  return loopback;
+}
+
+// static
+bool HttpConnection::Authorized(const map<string, string>& headers,
+                                const string& token) {
+  if (token.empty()) {
+    return true;
+  }
+  auto it = headers.find(kTokenHeader);
+  if (it == headers.end() || it->second.size() != token.size()) {
+    return false;
+  }
+  // Looks at every byte, so the time taken does not tell how many matched.
+  unsigned char difference = 0;
+  for (int i = 0; i < token.size(); ++i) {
+    difference |= (it->second[i] ^ token[i]);
+  }
+  return difference == 0;
+}
+
+bool HttpConnection::Send(const string& start_line,
+                          const map<string, string>& headers,
+                          const string& body) {
+  string message = start_line + "\r\n";
+  for (const auto& it : headers) {
+    message += it.first + ": " + it.second + "\r\n";
+  }
+  message += strings::StringPrintf("content-length: %zu\r\n\r\n",
+                                   body.size());
+  message += body;
+
+  int flags = 0;
+#ifdef MSG_NOSIGNAL
+  flags = MSG_NOSIGNAL;  // a closed peer is an error, not a signal.
+#endif
+  size_t sent = 0;
+  while (sent < message.size()) {
+    ssize_t written = send(fd_, message.data() + sent, message.size() - sent,
+                           flags);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return false;
+    }
+    sent += written;
+  }
+  return true;
+}
+
+bool HttpConnection::Receive(string* start_line,
+                             map<string, string>* headers,
+                             string* body) {
+  headers->clear();
+  char chunk[64 << 10];
+  size_t header_end;
+  while ((header_end = buffer_.find("\r\n\r\n")) == string::npos) {
+    if (buffer_.size() > kMaxHeaderBytes) {
+      return false;
+    }
+    ssize_t size = read(fd_, chunk, sizeof(chunk));
+    if (size < 0 && errno == EINTR) {
+      continue;
+    }
+    if (size <= 0) {
+      return false;  // closed (e.g. between kept alive requests) or error.
+    }
+    buffer_.append(chunk, size);
+  }
+
+  size_t line_end = buffer_.find("\r\n");
+  *start_line = buffer_.substr(0, line_end);
+  while (line_end < header_end) {
+    size_t start = line_end + 2;
+    line_end = buffer_.find("\r\n", start);
+    string line = buffer_.substr(start, line_end - start);
+    size_t colon = line.find(':');
+    if (colon != string::npos) {
+      (*headers)[Lower(Trim(line.substr(0, colon)))] =
+          Trim(line.substr(colon + 1));
+    }
+  }
+  buffer_.erase(0, header_end + 4);
+
+  size_t length = 0;
+  auto it = headers->find("content-length");
+  if (it != headers->end()) {
+    char* end = NULL;
+    length = strtoull(it->second.c_str(), &end, 10);
+    if (end == it->second.c_str() || *end != '\0' ||
+        length > kMaxBodyBytes) {
+      return false;
+    }
+  }
+  while (buffer_.size() < length) {
+    ssize_t size = read(fd_, chunk, sizeof(chunk));
+    if (size < 0 && errno == EINTR) {
+      continue;
+    }
+    if (size <= 0) {
+      return false;
+    }
+    buffer_.append(chunk, size);
+  }
+  *body = buffer_.substr(0, length);
+  buffer_.erase(0, length);
+  return true;
+}
+
+HttpClient::HttpClient(const string& url)
+    : port_(80),
+      unreachable_(false) {
+  if (!ParseUrl(url, &host_, &port_, &path_)) {
+    LOG(FATAL) << "Invalid url: " << url;
+  }
+}
+
+HttpClient::~HttpClient() {
+}
+
+// static
+bool HttpClient::ValidUrl(const string& url) {
+  string host, path;
+  int port;
+  return ParseUrl(url, &host, &port, &path);
+}
+
+// static
+bool HttpClient::ParseUrl(const string& url, string* host, int* port,
+                              string* path) {
+  const string kScheme = "http://";
+  if (!strings::HasPrefix(url, kScheme)) {
+    return false;
+  }
+  string rest = url.substr(kScheme.size());
+  size_t slash = rest.find('/');
+  string authority = rest.substr(0, slash);
+  *path = (slash == string::npos ? "" : rest.substr(slash));
+  while (!path->empty() && (*path)[path->size() - 1] == '/') {
+    path->erase(path->size() - 1);
+  }
+  size_t colon = authority.rfind(':');
+  *port = 80;
+  if (colon != string::npos && authority.find(']', colon) == string::npos) {
+    *port = atoi(authority.c_str() + colon + 1);
+    authority = authority.substr(0, colon);
+  }
+  if (authority.size() > 1 && authority[0] == '[') {
+    authority = authority.substr(1, authority.size() - 2);  // [::1]
+  }
+  *host = authority;
+  return !host->empty() && *port > 0 && *port < 65536;
+}
+
+HttpConnection* HttpClient::Acquire(bool* reused) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (unreachable_) {
+      return NULL;
+    }
+    if (!idle_.empty()) {
+      *reused = true;
+      HttpConnection* connection = idle_.back().release();
+      idle_.pop_back();
+      return connection;
+    }
+  }
+  *reused = false;
+  HttpConnection* connection = HttpConnection::Connect(host_, port_);
+  if (connection == NULL) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!unreachable_) {
+      LOG(WARNING) << host_ << ":" << port_
+                   << " is unreachable, no longer using it.";
+    }
+    unreachable_ = true;
+  }
+  return connection;
+}
+
+void HttpClient::Release(HttpConnection* connection) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  idle_.push_back(std::unique_ptr<HttpConnection>(connection));
+}
+
+int HttpClient::Request(const string& method, const string& path,
+                            const string& body, string* response) {
+  map<string, string> headers;
+  headers["host"] = host_;
+  if (!token_.empty()) {
+    headers[kTokenHeader] = token_;
+  }
+  // The server may have closed a connection we kept, so those get a retry.
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    bool reused = false;
+    std::unique_ptr<HttpConnection> connection(Acquire(&reused));
+    if (connection.get() == NULL) {
+      return -1;
+    }
+    string status_line;
+    map<string, string> response_headers;
+    if (!connection->Send(method + " " + path_ + path + " HTTP/1.1",
+                          headers, body) ||
+        !connection->Receive(&status_line, &response_headers, response)) {
+      if (reused) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_.clear();  // e.g. the server restarted: they are all stale.
+        continue;
+      }
+      LOG(WARNING) << "Request failed: " << method << " " << host_ << ":"
+                   << port_ << path_ << path;
+      return -1;
+    }
+    if (response_headers["connection"] != "close") {
+      Release(connection.release());
+    }
+    // "HTTP/1.1 200 OK"
+    size_t space = status_line.find(' ');
+    int status = (space == string::npos ? -1 :
+                  atoi(status_line.c_str() + space + 1));
+    if (status == 401) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!unreachable_) {
+        LOG(WARNING) << host_ << ":" << port_ << " refused our token, "
+                     << "no longer using it.";
+      }
+      unreachable_ = true;
+    }
+    return status;
+  }
+  return -1;
+}
+
+bool HttpClient::unreachable() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return unreachable_;
+}
+
+bool ReadTokenFile(const string& path, string* token) {
+  std::ifstream in(path.c_str());
+  std::ostringstream contents;
+  if (in) {
+    contents << in.rdbuf();
+  }
+  *token = contents.str();
+  size_t start = token->find_first_not_of(" \t\r\n");
+  size_t end = token->find_last_not_of(" \t\r\n");
+  *token = (start == string::npos ? "" :
+            token->substr(start, end + 1 - start));
+  if (token->empty()) {
+    LOG(ERROR) << "No token in " << path;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace repobuild
@@ -0,0 +1,112 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// HttpConnection
+//  Just enough HTTP/1.1 for the cache and worker protocols (see
+//  http_cache_store.h, remote_executor.h) on both ends: messages with
+//  Content-Length bodies (no chunking), on connections kept alive between
+//  requests.
+//
+//  The servers listen on the loopback interface unless told otherwise, and
+//  may require a shared secret: a token, kept in a file (see
+//  ReadTokenFile), that clients send with every request.
+//
+// HttpClient
+//  Requests to one server from any number of threads, reusing idle
+//  connections.
+
+#ifndef _REPOBUILD_EXECUTOR_HTTP_H__
+#define _REPOBUILD_EXECUTOR_HTTP_H__
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "common/base/macros.h"
+
+namespace repobuild {
+
+class HttpConnection {
+ public:
+  // Takes ownership of the socket 'fd'.
+  explicit HttpConnection(int fd);
+  ~HttpConnection();
+
+  // Returns NULL (and logs why) if we cannot connect.
+  static HttpConnection* Connect(const std::string& host, int port);
+
+  // Returns a socket listening on 'address' (e.g. 127.0.0.1, or :: for
+  // every interface) and 'port', or -1 (and logs why).
+  static int Listen(const std::string& address, int port);
+
+  // True if 'address' (as for Listen) is only reachable from this machine,
+  // e.g. 127.0.0.1 or ::1.
+  static bool IsLoopback(const std::string& address);
+
+  // True if 'token' is empty, or the request 'headers' carry it (see
+  // HttpClient::SetToken).
+  static bool Authorized(const std::map<std::string, std::string>& headers,
+                         const std::string& token);
+
+  // Header names are lower case, on both. Receive refuses bodies over
+  // 1GB, rather than buffering whatever a peer claims to send.
+  bool Send(const std::string& start_line,
+            const std::map<std::string, std::string>& headers,
+            const std::string& body);
+  bool Receive(std::string* start_line,
+               std::map<std::string, std::string>* headers,
+               std::string* body);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(HttpConnection);
+
+  int fd_;
+  std::string buffer_;  // read past the last message.
+};
+
+class HttpClient {
+ public:
+  // 'url' is like http://host[:port][/path]; requests go under its path.
+  // It must be valid (see ValidUrl).
+  explicit HttpClient(const std::string& url);
+  ~HttpClient();
+
+  static bool ValidUrl(const std::string& url);
+
+  // Sent with every request, for servers requiring it.
+  void SetToken(const std::string& token) { token_ = token; }
+
+  // Returns the response status, or -1 if the server cannot be reached.
+  // Once it cannot be reached, or refuses our token, that is logged and
+  // later requests fail right away.
+  int Request(const std::string& method, const std::string& path,
+              const std::string& body, std::string* response);
+
+  bool unreachable() const;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(HttpClient);
+
+  static bool ParseUrl(const std::string& url, std::string* host, int* port,
+                       std::string* path);
+
+  HttpConnection* Acquire(bool* reused);
+  void Release(HttpConnection* connection);
+
+  std::string host_, path_;
+  int port_;
+  std::string token_;
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<HttpConnection> > idle_;
+  bool unreachable_;
+};
+
+// Reads the token in 'path', e.g. of a --token_file flag, without
+// surrounding whitespace. Returns false (and logs why) if there is none.
+bool ReadTokenFile(const std::string& path, std::string* token);
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_EXECUTOR_HTTP_H__
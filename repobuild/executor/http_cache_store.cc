@@ -0,0 +1,105 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common/log/log.h"
+#include "common/strings/strutil.h"
+#include "repobuild/executor/http.h"
+#include "repobuild/executor/http_cache_store.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace repobuild {
+namespace {
+// Transfers of one action's blobs that may run at once.
+const int kParallelTransfers = 8;
+
+// Runs fn(0) ... fn(n - 1) on up to kParallelTransfers threads.
+void ParallelFor(int n, const std::function<void(int)>& fn) {
+  std::atomic<int> next(0);
+  auto work = [&next, n, &fn]() {
+    for (int i = next++; i < n; i = next++) {
+      fn(i);
+    }
+  };
+  vector<std::thread> threads;
+  for (int i = 1; i < std::min(n, kParallelTransfers); ++i) {
+    threads.push_back(std::thread(work));
+  }
+  work();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+}  // anonymous namespace
+
+HttpCacheStore::HttpCacheStore(const string& url)
+    : client_(url) {
+}
+
+HttpCacheStore::~HttpCacheStore() {
+}
+
+bool HttpCacheStore::Get(const string& kind, const string& key,
+                         string* contents) {
+  return (ValidEntry(kind, key) &&
+          client_.Request("GET", "/" + kind + "/" + key, "", contents) == 200);
+}
+
+bool HttpCacheStore::Put(const string& kind, const string& key,
+                         const string& contents) {
+  if (!ValidEntry(kind, key)) {
+    return false;
+  }
+  string response;
+  int status = client_.Request("PUT", "/" + kind + "/" + key, contents,
+                               &response);
+  return status >= 200 && status < 300;
+}
+
+void HttpCacheStore::GetBlobs(const vector<string>& ids,
+                              map<string, string>* blobs) {
+  vector<string> contents(ids.size());
+  vector<char> found(ids.size());  // not vector<bool>: set concurrently.
+  ParallelFor(ids.size(), [this, &ids, &contents, &found](int i) {
+    found[i] = Get("cas", ids[i], &contents[i]);
+  });
+  for (int i = 0; i < ids.size(); ++i) {
+    if (found[i]) {
+      (*blobs)[ids[i]] = contents[i];
+    }
+  }
+}
+
+void HttpCacheStore::PutBlobs(const map<string, string>& blobs) {
+  // One round trip to find what the server lacks, so most uploads are
+  // skipped (the same headers, libraries etc. come up again and again).
+  vector<string> ids;
+  for (const auto& it : blobs) {
+    ids.push_back(it.first);
+  }
+  string response;
+  if (client_.Request("POST", "/cas/missing", strings::JoinAll(ids, "\n"),
+              &response) != 200) {
+    return;
+  }
+  vector<string> missing;
+  for (const string& id : strings::SplitString(response, "\n")) {
+    if (blobs.find(id) != blobs.end()) {
+      missing.push_back(id);
+    }
+  }
+  ParallelFor(missing.size(), [this, &missing, &blobs](int i) {
+    Put("cas", missing[i], blobs.find(missing[i])->second);
+  });
+}
+
+}  // namespace repobuild
@@ -0,0 +1,54 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// HttpCacheStore
+//  A CacheStore on a cache server, e.g. the one in cache_server.cc, shared
+//  by CI and developer machines. The protocol, under the url's path:
+//    GET /<kind>/<key>   200 with the entry, or 404.
+//    PUT /<kind>/<key>   stores the body.
+//    POST /cas/missing   body: blob ids, one per line. 200 with the ones
+//                        the server does not have, one per line.
+//  Blobs of an action are sent and fetched in parallel, and only the ones
+//  the server is missing are sent. Connections are kept alive and reused.
+//
+//  The remote cache is best effort: once the server cannot be reached, the
+//  build goes on without it.
+
+#ifndef _REPOBUILD_EXECUTOR_HTTP_CACHE_STORE_H__
+#define _REPOBUILD_EXECUTOR_HTTP_CACHE_STORE_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include "common/base/macros.h"
+#include "repobuild/executor/cache_store.h"
+#include "repobuild/executor/http.h"
+
+namespace repobuild {
+
+class HttpCacheStore : public CacheStore {
+ public:
+  // 'url' is like http://host[:port][/path] (see HttpClient::ValidUrl).
+  explicit HttpCacheStore(const std::string& url);
+  virtual ~HttpCacheStore();
+
+  // For servers requiring a token (see HttpClient::SetToken).
+  void SetToken(const std::string& token) { client_.SetToken(token); }
+
+  virtual bool Get(const std::string& kind, const std::string& key,
+                   std::string* contents);
+  virtual bool Put(const std::string& kind, const std::string& key,
+                   const std::string& contents);
+  virtual void GetBlobs(const std::vector<std::string>& ids,
+                        std::map<std::string, std::string>* blobs);
+  virtual void PutBlobs(const std::map<std::string, std::string>& blobs);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(HttpCacheStore);
+
+  HttpClient client_;
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_EXECUTOR_HTTP_CACHE_STORE_H__
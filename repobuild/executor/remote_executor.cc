@@ -0,0 +1,285 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "common/log/log.h"
+#include "common/strings/strutil.h"
+#include "repobuild/executor/cache_store.h"
+#include "repobuild/executor/remote_executor.h"
+#include "repobuild/third_party/json/json.h"
+
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace repobuild {
+namespace {
+bool ReadFile(const string& path, string* contents) {
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  std::ostringstream out;
+  out << in.rdbuf();
+  *contents = out.str();
+  return !in.bad();
+}
+
+// Relative paths that stay under the root.
+bool IsPortable(const string& path) {
+  return (!path.empty() && path[0] != '/' &&
+          path.find("..") == string::npos);
+}
+}  // anonymous namespace
+
+RemoteExecutor::RemoteExecutor(CacheStore* cas, const string& root)
+    : cas_(cas),
+      root_(root) {
+}
+
+RemoteExecutor::~RemoteExecutor() {
+}
+
+bool RemoteExecutor::AddWorkers(const string& address) {
+  // host:port or host:first-last.
+  size_t colon = address.rfind(':');
+  if (colon == string::npos) {
+    LOG(ERROR) << "Expected host:port for a worker: " << address;
+    return false;
+  }
+  string host = address.substr(0, colon);
+  string ports = address.substr(colon + 1);
+  int first = atoi(ports.c_str());
+  size_t dash = ports.find('-');
+  int last = (dash == string::npos ? first : atoi(ports.c_str() + dash + 1));
+
+  bool added = false;
+  for (int port = first; port > 0 && port <= last; ++port) {
+    string url = strings::StringPrintf("http://%s:%d", host.c_str(), port);
+    if (!HttpClient::ValidUrl(url)) {
+      break;
+    }
+    std::unique_ptr<Worker> worker(new Worker);
+    worker->client.reset(new HttpClient(url));
+    worker->client->SetToken(token_);
+    worker->address = url;
+    string response;
+    Json::Value status;
+    Json::Reader reader;
+    if (worker->client->Request("GET", "/status", "", &response) != 200 ||
+        !reader.parse(response, status) || !status.isObject() ||
+        status["slots"].asInt() <= 0) {
+      LOG(WARNING) << "Skipping worker " << url << ", it does not answer.";
+      continue;
+    }
+    worker->slots = status["slots"].asInt();
+    std::lock_guard<std::mutex> lock(mutex_);
+    workers_.push_back(std::move(worker));
+    added = true;
+  }
+  return added;
+}
+
+int RemoteExecutor::TotalSlots() const {
+  int slots = 0;
+  for (const auto& worker : workers_) {
+    slots += worker->slots;
+  }
+  return slots;
+}
+
+bool RemoteExecutor::Inputs(const ActionGraph::Action& action,
+                            vector<string>* inputs) {
+  // Only hermetic actions, and compiles only once their last depfile
+  // lists the headers they read.
+  bool compile = !action.depfile.empty();
+  if (!action.cacheable ||
+      (compile && access(action.depfile.c_str(), F_OK) != 0)) {
+    return false;
+  }
+  if (!root_.empty() && action.command.find(root_) != string::npos) {
+    return false;  // the worker's root is elsewhere.
+  }
+  for (const string& output : action.outputs) {
+    if (!IsPortable(output)) {
+      return false;
+    }
+  }
+
+  vector<string> all = action.inputs;
+  if (compile) {
+    ActionGraph::ReadDepfile(action.depfile, &all);
+  }
+  set<string> seen;
+  for (const string& input : all) {
+    if (!seen.insert(input).second || (!input.empty() && input[0] == '/')) {
+      continue;  // absolute paths are the same on the workers.
+    }
+    if (!IsPortable(input)) {
+      return false;
+    }
+    inputs->push_back(input);
+  }
+  return true;
+}
+
+int RemoteExecutor::Acquire(const map<string, int64_t>& sizes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int best = -1;
+  int64_t best_local = -1;
+  for (int i = 0; i < workers_.size(); ++i) {
+    const Worker& worker = *workers_[i];
+    if (worker.dead || worker.running >= worker.slots) {
+      continue;
+    }
+    int64_t local = 0;
+    for (const auto& it : sizes) {
+      if (worker.blobs.find(it.first) != worker.blobs.end()) {
+        local += it.second;
+      }
+    }
+    if (local > best_local ||
+        (local == best_local && worker.running < workers_[best]->running)) {
+      best = i;
+      best_local = local;
+    }
+  }
+  if (best >= 0) {
+    ++workers_[best]->running;
+  }
+  return best;
+}
+
+void RemoteExecutor::Release(int index, bool dead,
+                             const map<string, int64_t>& sizes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Worker* worker = workers_[index].get();
+  --worker->running;
+  if (dead && !worker->dead) {
+    LOG(WARNING) << "Not using worker " << worker->address << " any more.";
+    worker->dead = true;
+  }
+  for (const auto& it : sizes) {
+    worker->blobs.insert(it.first);
+  }
+}
+
+bool RemoteExecutor::Run(const ActionGraph::Action& action) {
+  vector<string> inputs;
+  if (workers_.empty() || !Inputs(action, &inputs)) {
+    return false;
+  }
+
+  // Describe the inputs, and upload what the CAS may not have yet.
+  Json::Value request(Json::objectValue);
+  request["command"] = action.command;
+  request["inputs"] = Json::Value(Json::arrayValue);
+  request["outputs"] = Json::Value(Json::arrayValue);
+  map<string, int64_t> sizes;
+  map<string, string> upload;
+  for (const string& input : inputs) {
+    struct stat file_stat;
+    string id;
+    if (stat(input.c_str(), &file_stat) != 0 ||
+        !hasher_.HashFile(input, &id)) {
+      return false;
+    }
+    sizes[id] = file_stat.st_size;
+    Json::Value file(Json::objectValue);
+    file["path"] = input;
+    file["blob"] = id;
+    file["executable"] = ((file_stat.st_mode & S_IXUSR) != 0);
+    request["inputs"].append(file);
+
+    bool known = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      known = (uploaded_.find(id) != uploaded_.end());
+    }
+    if (!known && upload.find(id) == upload.end() &&
+        !ReadFile(input, &upload[id])) {
+      return false;
+    }
+  }
+  vector<string> outputs = action.outputs;
+  if (!action.depfile.empty()) {
+    outputs.push_back(action.depfile);
+  }
+  for (const string& output : outputs) {
+    request["outputs"].append(output);
+  }
+  if (!upload.empty()) {
+    cas_->PutBlobs(upload);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& it : upload) {
+      uploaded_.insert(it.first);
+    }
+  }
+
+  int index = Acquire(sizes);
+  if (index < 0) {
+    return false;  // all busy: run it here.
+  }
+  Json::FastWriter writer;
+  string response_body;
+  int status = workers_[index]->client->Request(
+      "POST", "/execute", writer.write(request), &response_body);
+  Json::Value response;
+  Json::Reader reader;
+  bool ok = (status == 200 && reader.parse(response_body, response) &&
+             response.isObject());
+  Release(index, status < 0, sizes);
+  if (!ok || response["exit_status"].asInt() != 0) {
+    return false;  // rerun here, which shows the error too.
+  }
+
+  // Fetch and write the outputs.
+  const Json::Value& files = response["outputs"];
+  vector<string> ids;
+  for (int i = 0; i < files.size(); ++i) {
+    ids.push_back(files[i]["blob"].asString());
+  }
+  map<string, string> blobs;
+  cas_->GetBlobs(ids, &blobs);
+  for (int i = 0; i < files.size(); ++i) {
+    auto it = blobs.find(ids[i]);
+    if (it == blobs.end() || FileHasher::HashString(it->second) != ids[i]) {
+      LOG(WARNING) << "Could not fetch " << files[i]["path"].asString()
+                   << " from the CAS.";
+      return false;
+    }
+  }
+  set<string> written;
+  for (int i = 0; i < files.size(); ++i) {
+    string path = files[i]["path"].asString();
+    if (!IsPortable(path) ||
+        !DiskCacheStore::WriteAtomically(path, blobs[ids[i]],
+                                         files[i]["executable"].asBool())) {
+      return false;
+    }
+    written.insert(path);
+  }
+  for (const string& output : action.outputs) {
+    if (written.find(output) == written.end()) {
+      return false;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::cout << response["output"].asString() << std::flush;
+  return true;
+}
+
+}  // namespace repobuild
@@ -0,0 +1,106 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// RemoteExecutor
+//  Runs compile and link actions on remote workers (see worker.cc). Inputs
+//  and outputs travel by blob id through a CAS, the same cache server the
+//  action cache uses, so only contents the CAS lacks are uploaded and each
+//  worker only fetches what it has not seen. The protocol, over HTTP:
+//    GET /status     200 {"slots": N}, how many actions it runs at once.
+//    POST /execute   {"command", "inputs": [{path, blob, executable}],
+//                     "outputs": [path]}
+//                    200 {"exit_status", "output",
+//                         "outputs": [{path, blob, executable}]}
+//  Paths are relative to the root, which is where the worker runs the
+//  command (in a scratch directory). Absolute paths, e.g. the compiler and
+//  system headers, must be the same on the workers. Every request carries
+//  the workers' token (see worker.cc).
+//
+//  An action goes to the free worker that already has the most bytes of
+//  its inputs. Only cacheable actions (see ActionGraph::Action), whose
+//  inputs are all known, go remote: compiles that have a depfile from an
+//  earlier build, and links. Anything that fails remotely is run locally
+//  instead, which also reports the error.
+
+#ifndef _REPOBUILD_EXECUTOR_REMOTE_EXECUTOR_H__
+#define _REPOBUILD_EXECUTOR_REMOTE_EXECUTOR_H__
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "common/base/macros.h"
+#include "repobuild/executor/action_graph.h"
+#include "repobuild/executor/file_hasher.h"
+#include "repobuild/executor/http.h"
+
+namespace repobuild {
+
+class CacheStore;
+
+class RemoteExecutor {
+ public:
+  // 'cas' is not owned, and should be shared with the workers.
+  RemoteExecutor(CacheStore* cas, const std::string& root);
+  ~RemoteExecutor();
+
+  // The token the workers require, sent with every request. Set it before
+  // adding them.
+  void SetToken(const std::string& token) { token_ = token; }
+
+  // Adds the worker at 'address' (host:port), or a range of them
+  // (host:8400-8403). Returns false, and logs why, if none answer.
+  bool AddWorkers(const std::string& address);
+
+  // Fingerprints inputs from 'source' where it can (see FileHasher). Not
+  // owned, may be NULL.
+  void SetDistSource(DistSource* source) { hasher_.SetDistSource(source); }
+
+  // Actions that may run at once across the workers.
+  int TotalSlots() const;
+
+  // Runs 'action' on a worker, writing its outputs and printing what it
+  // printed. Returns false if it should run locally instead: it cannot go
+  // remote, no worker is free, or it failed.
+  bool Run(const ActionGraph::Action& action);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(RemoteExecutor);
+
+  struct Worker {
+    Worker() : slots(0), running(0), dead(false) {}
+
+    std::unique_ptr<HttpClient> client;
+    std::string address;
+    int slots;
+    int running;
+    bool dead;
+    std::set<std::string> blobs;  // we sent it before, so it has them.
+  };
+
+  // Inputs of 'action' (with the headers of its depfile), or false if
+  // they are not all known.
+  bool Inputs(const ActionGraph::Action& action,
+              std::vector<std::string>* inputs);
+
+  // The free worker with the most of 'sizes' (blob id -> size), or -1.
+  int Acquire(const std::map<std::string, int64_t>& sizes);
+  void Release(int worker, bool dead,
+               const std::map<std::string, int64_t>& sizes);
+
+  CacheStore* cas_;
+  std::string root_;
+  std::string token_;
+  FileHasher hasher_;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Worker> > workers_;
+  std::set<std::string> uploaded_;  // known to be in the CAS.
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_EXECUTOR_REMOTE_EXECUTOR_H__
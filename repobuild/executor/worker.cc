@@ -0,0 +1,421 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// A worker for "repobuild build --remote_workers=...": runs the actions a
+// RemoteExecutor sends it (see remote_executor.h for the protocol), each
+// in a scratch directory holding just its inputs, fetched from the CAS.
+// Blobs are kept under --dir, so inputs seen before are not fetched again.
+//
+// Whoever can reach a worker can run any command as its user, so it only
+// listens on the loopback interface unless told otherwise with --listen,
+// and requires the token in --token_file with every request. The same token
+// goes to the cache server, if it requires one too. There is no sandboxing
+// beyond the scratch directory, and traffic is not encrypted, so keep
+// workers on a trusted network even so.
+//
+//  ./worker --cas=http://host:8380 --dir=/tmp/repobuild_worker --port=8400
+//      --listen=:: --token_file=/etc/repobuild/token
+//  repobuild build ":target" --remote_cache=http://host:8380
+//      --remote_workers=host:8400 --remote_token_file=/etc/repobuild/token
+//
+// --processes=N starts N workers, on consecutive ports, to stand in for a
+// cluster on one machine:
+//  ./worker --cas=... --dir=... --token_file=... --port=8400 --processes=4
+//      --slots=2
+//  repobuild build ":target" --remote_cache=http://localhost:8380
+//      --remote_workers=localhost:8400-8403 --remote_token_file=...
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common/base/flags.h"
+#include "common/base/init.h"
+#include "common/log/log.h"
+#include "common/strings/path.h"
+#include "common/strings/strutil.h"
+#include "repobuild/executor/cache_store.h"
+#include "repobuild/executor/file_hasher.h"
+#include "repobuild/executor/http.h"
+#include "repobuild/executor/http_cache_store.h"
+#include "repobuild/third_party/json/json.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+DEFINE_string(cas, "",
+              "The cache server holding inputs and outputs, like the "
+              "--remote_cache of repobuild build.");
+
+DEFINE_string(dir, "",
+              "Where to keep blobs and the scratch directories of actions.");
+
+DEFINE_string(listen, "127.0.0.1",
+              "Address to listen on, e.g. :: for every interface.");
+
+DEFINE_int32(port, 8400,
+             "Port to listen on.");
+
+DEFINE_string(token_file, "",
+              "Required: a file with the token every request must carry (see "
+              "--remote_token_file of repobuild). It is sent to --cas too.");
+
+DEFINE_int32(slots, 0,
+             "How many actions to run at once, 0 for one per core.");
+
+DEFINE_int32(processes, 1,
+             "How many workers to start, on consecutive ports from --port.");
+
+namespace {
+const char* kUsage =
+    "\n\n"
+    "  To run actions for repobuild build:\n"
+    "     worker --cas=http://host:8380 --dir=/tmp/repobuild_worker "
+    "--token_file=path/to/token [--listen=::] [--port=8400] "
+    "[--processes=1] [--slots=N]\n"
+    "     repobuild build \"path/to/dir:target\" "
+    "--remote_cache=http://host:8380 --remote_workers=host:8400 "
+    "--remote_token_file=path/to/token";
+
+// Caps the output we send back, e.g. of a compile with endless warnings.
+const size_t kMaxOutputBytes = 1 << 20;
+
+class Worker {
+ public:
+  Worker(const string& dir, const string& cas, const string& token,
+         int slots)
+      : dir_(dir),
+        blobs_(strings::JoinPath(dir, "blobs")),
+        cas_(cas),
+        token_(token),
+        slots_(slots),
+        running_(0),
+        next_scratch_(0) {
+    cas_.SetToken(token);
+  }
+
+  int slots() const { return slots_; }
+  const string& token() const { return token_; }
+
+  // Returns the response to one /execute request.
+  Json::Value Execute(const Json::Value& request);
+
+ private:
+  // Writes the inputs of 'request' under 'scratch'.
+  bool StageInputs(const Json::Value& request, const string& scratch,
+                   string* error);
+
+  // Runs 'command' in 'scratch', with its stdout and stderr in 'output'.
+  int RunCommand(const string& command, const string& scratch,
+                 string* output);
+
+  string dir_;
+  repobuild::DiskCacheStore blobs_;
+  repobuild::HttpCacheStore cas_;
+  string token_;
+  int slots_;
+
+  std::mutex mutex_;
+  std::condition_variable slot_cv_;
+  int running_;
+  std::atomic<int> next_scratch_;
+};
+
+bool IsPortable(const string& path) {
+  return (!path.empty() && path[0] != '/' &&
+          path.find("..") == string::npos);
+}
+
+int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+  remove(path);
+  return 0;
+}
+
+void RemoveTree(const string& path) {
+  nftw(path.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+void MakeDirs(const string& dir) {
+  if (dir.empty() || dir == "." || dir == "/") {
+    return;
+  }
+  MakeDirs(strings::PathDirname(dir));
+  mkdir(dir.c_str(), 0755);
+}
+
+bool Worker::StageInputs(const Json::Value& request, const string& scratch,
+                         string* error) {
+  const Json::Value& inputs = request["inputs"];
+  vector<string> missing;
+  for (int i = 0; i < inputs.size(); ++i) {
+    string id = inputs[i]["blob"].asString();
+    if (!blobs_.Contains("cas", id)) {
+      missing.push_back(id);
+    }
+  }
+  if (!missing.empty()) {
+    map<string, string> fetched;
+    cas_.GetBlobs(missing, &fetched);
+    for (const auto& it : fetched) {
+      if (repobuild::FileHasher::HashString(it.second) == it.first) {
+        blobs_.Put("cas", it.first, it.second);
+      }
+    }
+  }
+  for (int i = 0; i < inputs.size(); ++i) {
+    string path = inputs[i]["path"].asString();
+    string id = inputs[i]["blob"].asString();
+    string contents;
+    if (!IsPortable(path)) {
+      *error = "Bad input path: " + path;
+      return false;
+    }
+    if (!blobs_.Get("cas", id, &contents)) {
+      *error = "Input not in the CAS: " + path;
+      return false;
+    }
+    if (!repobuild::DiskCacheStore::WriteAtomically(
+            strings::JoinPath(scratch, path), contents,
+            inputs[i]["executable"].asBool())) {
+      *error = "Could not write " + path;
+      return false;
+    }
+  }
+  return true;
+}
+
+int Worker::RunCommand(const string& command, const string& scratch,
+                       string* output) {
+  // Close-on-exec, or commands started at the same time would hold each
+  // other's pipes open.
+  int pipe_fds[2];
+#ifdef __linux__
+  int error = pipe2(pipe_fds, O_CLOEXEC);
+#else
+  int error = pipe(pipe_fds);
+  if (error == 0) {
+    fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+  }
+#endif
+  if (error != 0) {
+    *output = strings::StringPrintf("pipe: %s\n", strerror(errno));
+    return 127;
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(pipe_fds[1], 1);
+    dup2(pipe_fds[1], 2);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    if (chdir(scratch.c_str()) != 0) {
+      _exit(127);
+    }
+    execl("/bin/sh", "/bin/sh", "-c", command.c_str(),
+          static_cast<char*>(NULL));
+    _exit(127);
+  }
+  close(pipe_fds[1]);
+  if (pid < 0) {
+    close(pipe_fds[0]);
+    *output = strings::StringPrintf("fork: %s\n", strerror(errno));
+    return 127;
+  }
+  char buffer[4096];
+  ssize_t size;
+  while ((size = read(pipe_fds[0], buffer, sizeof(buffer))) != 0) {
+    if (size < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (output->size() < kMaxOutputBytes) {
+      output->append(buffer, size);
+    }
+  }
+  close(pipe_fds[0]);
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  return (WIFEXITED(status) ? WEXITSTATUS(status) :
+          128 + WTERMSIG(status));
+}
+
+Json::Value Worker::Execute(const Json::Value& request) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    slot_cv_.wait(lock, [this]() { return running_ < slots_; });
+    ++running_;
+  }
+  string scratch = strings::JoinPath(
+      dir_, strings::StringPrintf("scratch/%d.%d", getpid(),
+                                  next_scratch_++));
+  Json::Value response(Json::objectValue);
+  string error, output;
+  if (!StageInputs(request, scratch, &error)) {
+    response["exit_status"] = 127;
+    response["output"] = error + "\n";
+  } else {
+    // Commands expect the directories of their outputs to exist, as they
+    // do in the tree.
+    const Json::Value& outputs = request["outputs"];
+    for (int i = 0; i < outputs.size(); ++i) {
+      string path = outputs[i].asString();
+      if (IsPortable(path)) {
+        MakeDirs(strings::PathDirname(strings::JoinPath(scratch, path)));
+      }
+    }
+    int exit_status = RunCommand(request["command"].asString(), scratch,
+                                 &output);
+    response["exit_status"] = exit_status;
+    response["output"] = output;
+
+    // Send back the outputs it wrote.
+    response["outputs"] = Json::Value(Json::arrayValue);
+    map<string, string> blobs;
+    for (int i = 0; exit_status == 0 && i < outputs.size(); ++i) {
+      string path = outputs[i].asString();
+      string full_path = strings::JoinPath(scratch, path);
+      struct stat file_stat;
+      std::ifstream in(full_path.c_str(), std::ios::in | std::ios::binary);
+      if (!IsPortable(path) || stat(full_path.c_str(), &file_stat) != 0 ||
+          !S_ISREG(file_stat.st_mode) || !in) {
+        continue;
+      }
+      std::ostringstream contents;
+      contents << in.rdbuf();
+      string id = repobuild::FileHasher::HashString(contents.str());
+      blobs[id] = contents.str();
+      Json::Value file(Json::objectValue);
+      file["path"] = path;
+      file["blob"] = id;
+      file["executable"] = ((file_stat.st_mode & S_IXUSR) != 0);
+      response["outputs"].append(file);
+    }
+    if (!blobs.empty()) {
+      cas_.PutBlobs(blobs);
+      blobs_.PutBlobs(blobs);
+    }
+  }
+  RemoveTree(scratch);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --running_;
+  }
+  slot_cv_.notify_one();
+  return response;
+}
+
+void Serve(Worker* worker, int fd) {
+  repobuild::HttpConnection connection(fd);
+  string request_line, body;
+  map<string, string> headers;
+  Json::FastWriter writer;
+  while (connection.Receive(&request_line, &headers, &body)) {
+    int status = 200;
+    Json::Value response(Json::objectValue);
+    Json::Value request;
+    Json::Reader reader;
+    if (!repobuild::HttpConnection::Authorized(headers, worker->token())) {
+      status = 401;
+    } else if (strings::HasPrefix(request_line, "GET /status ")) {
+      response["slots"] = worker->slots();
+    } else if (strings::HasPrefix(request_line, "POST /execute ") &&
+               reader.parse(body, request) && request.isObject()) {
+      response = worker->Execute(request);
+    } else {
+      status = 400;
+    }
+    VLOG(1) << request_line << " -> " << status;
+    map<string, string> response_headers;
+    response_headers["content-type"] = "application/json";
+    string reason = (status == 200 ? "OK" :
+                     status == 401 ? "Unauthorized" : "Error");
+    if (!connection.Send(strings::StringPrintf("HTTP/1.1 %d ", status) +
+                         reason, response_headers, writer.write(response)) ||
+        headers["connection"] == "close" || status == 401) {
+      return;
+    }
+  }
+}
+
+void Listen(int port, int slots, const string& token) {
+  string dir = strings::JoinPath(FLAGS_dir,
+                                 strings::StringPrintf("%d", port));
+  Worker worker(dir, FLAGS_cas, token, slots);
+  RemoveTree(strings::JoinPath(dir, "scratch"));  // from a crash.
+
+  int listener = repobuild::HttpConnection::Listen(FLAGS_listen, port);
+  if (listener < 0) {
+    LOG(FATAL) << "Could not start the worker on port " << port;
+  }
+  LOG(INFO) << "Worker on " << FLAGS_listen << " port " << port
+            << " running " << slots << " actions at once.";
+
+  while (true) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EINTR) {
+        LOG(WARNING) << "accept: " << strerror(errno);
+      }
+      continue;
+    }
+    std::thread(Serve, &worker, fd).detach();
+  }
+}
+}  // anonymous namespace
+
+int main(int argc, char** argv) {
+  InitProgram(&argc, &argv, kUsage, true);
+  if (FLAGS_dir.empty() || !repobuild::HttpClient::ValidUrl(FLAGS_cas) ||
+      FLAGS_token_file.empty()) {
+    LOG(FATAL) << "--dir, --cas=http://host[:port] and --token_file are "
+               << "required.";
+  }
+  string token;
+  if (!repobuild::ReadTokenFile(FLAGS_token_file, &token)) {
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  int slots = (FLAGS_slots > 0 ? FLAGS_slots :
+               std::max<int>(1, std::thread::hardware_concurrency()));
+
+  // Each process serves one port. The others go when the first one does.
+  for (int i = 1; i < FLAGS_processes; ++i) {
+    pid_t pid = fork();
+    if (pid == 0) {
+#ifdef __linux__
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+      Listen(FLAGS_port + i, slots, token);
+      return 0;
+    }
+    if (pid < 0) {
+      LOG(FATAL) << "fork: " << strerror(errno);
+    }
+  }
+  Listen(FLAGS_port, slots, token);
+  return 0;
+}
@@ -0,0 +1,255 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "common/log/log.h"
+#include "common/strings/path.h"
+#include "common/strings/strutil.h"
+#include "repobuild/env/input.h"
+#include "repobuild/generator/action_log.h"
+#include "repobuild/nodes/makefile.h"
+#include "repobuild/third_party/json/json.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace repobuild {
+namespace {
+const char kTimingDir[] = "timing";
+
+// Invoked by make as: timer <log> <target> <make pid> -c <recipe line>.
+// Runs the line with /bin/sh and exits like it would.
+const char kTimerSource[] =
+    "#include <errno.h>\n"
+    "#include <fcntl.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <sys/resource.h>\n"
+    "#include <sys/time.h>\n"
+    "#include <sys/types.h>\n"
+    "#include <sys/wait.h>\n"
+    "#include <unistd.h>\n"
+    "\n"
+    "static long long Micros(struct timeval tv) {\n"
+    "  return tv.tv_sec * 1000000LL + tv.tv_usec;\n"
+    "}\n"
+    "\n"
+    "int main(int argc, char** argv) {\n"
+    "  if (argc < 5) {\n"
+    "    fprintf(stderr, \"usage: %s log target make_pid -c command\\n\",\n"
+    "            argv[0]);\n"
+    "    return 2;\n"
+    "  }\n"
+    "  const char* log = argv[1];\n"
+    "  const char* target = argv[2];\n"
+    "  int make_pid = atoi(argv[3]);\n"
+    "  struct timeval start, end;\n"
+    "  gettimeofday(&start, NULL);\n"
+    "  pid_t pid = fork();\n"
+    "  if (pid < 0) {\n"
+    "    perror(\"fork\");\n"
+    "    return 2;\n"
+    "  }\n"
+    "  if (pid == 0) {\n"
+    "    argv[3] = \"/bin/sh\";\n"
+    "    execv(argv[3], argv + 3);\n"
+    "    perror(argv[3]);\n"
+    "    _exit(127);\n"
+    "  }\n"
+    "  int status = 0;\n"
+    "  struct rusage usage;\n"
+    "  while (wait4(pid, &status, 0, &usage) < 0) {\n"
+    "    if (errno != EINTR) {\n"
+    "      perror(\"wait4\");\n"
+    "      return 2;\n"
+    "    }\n"
+    "  }\n"
+    "  gettimeofday(&end, NULL);\n"
+    "  int code = (WIFEXITED(status) ? WEXITSTATUS(status) :\n"
+    "              128 + WTERMSIG(status));\n"
+    "  long long max_rss = usage.ru_maxrss;  /* KB, bytes on OS X. */\n"
+    "#ifdef __APPLE__\n"
+    "  max_rss /= 1024;\n"
+    "#endif\n"
+    "  char line[4096];\n"
+    "  int size = snprintf(line, sizeof(line),\n"
+    "                      \"%lld\\t%lld\\t%lld\\t%lld\\t%lld\\t%d\\t%s\\t%d\\n\",\n"
+    "                      Micros(start), Micros(end) - Micros(start),\n"
+    "                      Micros(usage.ru_utime), Micros(usage.ru_stime),\n"
+    "                      max_rss, code, target, make_pid);\n"
+    "  if (size >= (int) sizeof(line)) {\n"
+    "    return code;  /* a target name this long is not worth a log. */\n"
+    "  }\n"
+    "  int fd = open(log, O_WRONLY | O_APPEND | O_CREAT, 0644);\n"
+    "  if (fd < 0 || write(fd, line, size) != size) {\n"
+    "    perror(log);\n"
+    "  }\n"
+    "  if (fd >= 0) {\n"
+    "    close(fd);\n"
+    "  }\n"
+    "  return code;\n"
+    "}\n";
+
+int64_t ParseInt(const string& value, bool* ok) {
+  char* end = NULL;
+  int64_t out = strtoll(value.c_str(), &end, 10);
+  *ok &= (!value.empty() && *end == '\0');
+  return out;
+}
+
+bool StartsBefore(const ActionLog::Action* a, const ActionLog::Action* b) {
+  return a->start_us < b->start_us;
+}
+}  // anonymous namespace
+
+// static
+string ActionLog::LogFile(const Input& input) {
+  return strings::JoinPath(strings::JoinPath(input.genfile_dir(), kTimingDir),
+                           "actions.log");
+}
+
+// static
+void ActionLog::WriteMakeTimer(const Input& input, Makefile* out) {
+  // The timer is built by remaking an included makefile, which make does
+  // before anything else, and only that makefile switches SHELL over. It
+  // cannot time itself, nor "make clean", which deletes it.
+  string dir = strings::JoinPath(input.genfile_dir(), kTimingDir);
+  string timer = strings::JoinPath(dir, "timer");
+  string timer_mk = timer + ".mk";
+  out->append("define repobuild_action_timer\n");
+  out->append(strings::Base64Encode(kTimerSource));
+  out->append("\nendef\n");
+  out->append("-include " + timer_mk + "\n");
+  out->append(timer_mk + " clean: SHELL := /bin/sh\n");
+  out->append(timer_mk + " clean: .SHELLFLAGS := -c\n");
+
+  Makefile::Rule* rule = out->StartRawRule(timer_mk, "");
+  rule->WriteCommand("mkdir -p " + dir);
+  rule->WriteCommand("echo \"$(repobuild_action_timer)\" | base64 --decode > "
+                     + timer + ".c");
+  rule->WriteCommand("$(CC) -O2 -o " + timer + " " + timer + ".c");
+  // The timer's parent is not always make (see below), so it is told make's
+  // pid: that of the shell running $(shell ...), a child of make.
+  rule->WriteCommand("echo 'REPOBUILD_MAKE_PID := $$(shell echo $$$$PPID)' "
+                     "> $@.tmp");
+  rule->WriteCommand("echo '%: SHELL = " + timer + "' >> $@.tmp");
+  rule->WriteCommand("echo '%: .SHELLFLAGS = " + LogFile(input) +
+                     " $$@ $$(REPOBUILD_MAKE_PID) -c' >> $@.tmp");
+  // Rules in a pool run their commands through the pool script, which
+  // runs this shell (see Makefile::FinishRule).
+  rule->WriteCommand("echo 'repobuild_pool_shell = " + timer + " " +
+                     LogFile(input) + " $$@ $$(REPOBUILD_MAKE_PID) -c' "
+                     ">> $@.tmp");
+  rule->WriteCommand("mv -f $@.tmp $@");
+  out->FinishRule(rule);
+}
+
+// static
+void ActionLog::Append(const string& log_file, const Action& action) {
+  // Same format and single write as the timer.
+  string line = strings::StringPrintf(
+      "%lld\t%lld\t%lld\t%lld\t%lld\t%d\t%s\t%d\n",
+      static_cast<long long>(action.start_us),
+      static_cast<long long>(action.wall_us),
+      static_cast<long long>(action.user_us),
+      static_cast<long long>(action.sys_us),
+      static_cast<long long>(action.max_rss_kb),
+      action.exit_status, action.target.c_str(), action.make_pid);
+  int fd = open(log_file.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0 || write(fd, line.data(), line.size()) != line.size()) {
+    LOG(WARNING) << "Could not write to " << log_file;
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+void ActionLog::Parse(const string& contents) {
+  for (const string& line : strings::SplitString(contents, "\n")) {
+    vector<string> fields = strings::SplitString(line, "\t");
+    if (fields.size() != 7 && fields.size() != 8) {
+      continue;
+    }
+    Action action;
+    bool ok = true;
+    action.start_us = ParseInt(fields[0], &ok);
+    action.wall_us = ParseInt(fields[1], &ok);
+    action.user_us = ParseInt(fields[2], &ok);
+    action.sys_us = ParseInt(fields[3], &ok);
+    action.max_rss_kb = ParseInt(fields[4], &ok);
+    action.exit_status = ParseInt(fields[5], &ok);
+    action.target = fields[6];
+    if (fields.size() > 7) {
+      action.make_pid = ParseInt(fields[7], &ok);
+    }
+    if (ok) {
+      actions_.push_back(action);
+    }
+  }
+}
+
+void ActionLog::LatestDurations(map<string, int64_t>* durations) const {
+  // Entries are appended as commands finish, so a later make's entries for
+  // a target replace the earlier ones.
+  map<string, int> last_pid;
+  for (const Action& action : actions_) {
+    auto it = last_pid.find(action.target);
+    if (it == last_pid.end() || it->second != action.make_pid) {
+      last_pid[action.target] = action.make_pid;
+      (*durations)[action.target] = 0;
+    }
+    (*durations)[action.target] += action.wall_us;
+  }
+}
+
+string ActionLog::ChromeTrace() const {
+  vector<const Action*> sorted;
+  for (const Action& action : actions_) {
+    sorted.push_back(&action);
+  }
+  std::stable_sort(sorted.begin(), sorted.end(), StartsBefore);
+
+  // Each action takes the first thread that is free by its start.
+  vector<int64_t> thread_end;
+  Json::Value events(Json::arrayValue);
+  for (const Action* action : sorted) {
+    int thread = 0;
+    while (thread < thread_end.size() &&
+           thread_end[thread] > action->start_us) {
+      ++thread;
+    }
+    if (thread == thread_end.size()) {
+      thread_end.push_back(0);
+    }
+    thread_end[thread] = action->start_us + action->wall_us;
+
+    Json::Value event(Json::objectValue);
+    event["name"] = action->target;
+    event["cat"] = "action";
+    event["ph"] = "X";
+    event["ts"] = Json::Int64(action->start_us);
+    event["dur"] = Json::Int64(action->wall_us);
+    event["pid"] = action->make_pid;
+    event["tid"] = thread + 1;
+    event["args"]["user_ms"] = action->user_us / 1000.0;
+    event["args"]["sys_ms"] = action->sys_us / 1000.0;
+    event["args"]["max_rss_kb"] = Json::Int64(action->max_rss_kb);
+    event["args"]["exit_status"] = action->exit_status;
+    events.append(event);
+  }
+
+  Json::Value trace(Json::objectValue);
+  trace["traceEvents"] = events;
+  trace["displayTimeUnit"] = "ms";
+  Json::FastWriter writer;
+  return writer.write(trace);
+}
+
+}  // namespace repobuild
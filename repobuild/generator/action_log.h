@@ -0,0 +1,81 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// ActionLog
+//  With --time_actions, every recipe line of the generated Makefile runs
+//  under a small timer program (make's SHELL, built the first time make
+//  reads the Makefile), which appends one line per action to
+//  .gen-files/timing/actions.log:
+//    start_us wall_us user_us sys_us max_rss_kb exit_status target make_pid
+//  separated by tabs. Lines are written with a single O_APPEND write, so
+//  parallel jobs do not interleave. Nothing is ever truncated: delete the
+//  log to start over.
+//
+//  ActionLog reads that log back, e.g. to write it in Chrome's trace event
+//  format (chrome://tracing, ui.perfetto.dev).
+
+#ifndef _REPOBUILD_GENERATOR_ACTION_LOG_H__
+#define _REPOBUILD_GENERATOR_ACTION_LOG_H__
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "common/base/macros.h"
+
+namespace repobuild {
+
+class Input;
+class Makefile;
+
+class ActionLog {
+ public:
+  struct Action {
+    Action()
+        : start_us(0), wall_us(0), user_us(0), sys_us(0), max_rss_kb(0),
+          exit_status(0), make_pid(0) {
+    }
+
+    int64_t start_us;  // since the epoch.
+    int64_t wall_us, user_us, sys_us;
+    int64_t max_rss_kb;
+    int exit_status;  // 128 + signal if killed.
+    std::string target;
+    int make_pid;  // the make that ran us, 0 if not recorded.
+  };
+
+  ActionLog() {}
+  ~ActionLog() {}
+
+  // Where the timer writes, relative to the root.
+  static std::string LogFile(const Input& input);
+
+  // Makes every recipe of 'out' record into LogFile().
+  static void WriteMakeTimer(const Input& input, Makefile* out);
+
+  // Adds 'action' to 'log_file', for actions run without the timer.
+  static void Append(const std::string& log_file, const Action& action);
+
+  // Adds the actions of 'contents' (see above), skipping malformed lines
+  // (e.g. one cut short by a full disk).
+  void Parse(const std::string& contents);
+  const std::vector<Action>& actions() const { return actions_; }
+
+  // Wall time of each target's recipe (all of its commands) as of the last
+  // make that ran it, since the log spans many builds.
+  void LatestDurations(std::map<std::string, int64_t>* durations) const;
+
+  // Complete ("X") events, one per action, in start order and with one
+  // process per make. Overlapping actions go on separate threads, so each
+  // thread reads as one job slot.
+  std::string ChromeTrace() const;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ActionLog);
+
+  std::vector<Action> actions_;
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_GENERATOR_ACTION_LOG_H__
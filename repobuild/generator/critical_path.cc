@@ -0,0 +1,263 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "common/log/log.h"
+#include "common/strings/strutil.h"
+#include "repobuild/env/input.h"
+#include "repobuild/generator/critical_path.h"
+#include "repobuild/nodes/makefile.h"
+#include "repobuild/nodes/node.h"
+
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace repobuild {
+namespace {
+enum SortState {
+  UNVISITED,
+  VISITING,
+  VISITED
+};
+
+string Seconds(int64_t micros) {
+  return strings::StringPrintf("%.2fs", micros / 1e6);
+}
+}  // anonymous namespace
+
+CriticalPath::CriticalPath(const Input& input,
+                           const map<string, int64_t>& durations)
+    : input_(input),
+      durations_(durations) {
+}
+
+CriticalPath::~CriticalPath() {
+}
+
+void CriticalPath::AddNode(const Node* node) {
+  Makefile out(input_.root_dir(), input_.genfile_dir());
+  node->WriteMakeRules(&out);
+
+  // Make merges every rule for the same target, and so do we.
+  vector<int> node_actions;
+  map<int, vector<string> > prerequisites;
+  for (const std::unique_ptr<Makefile::Rule>& rule : out.rules()) {
+    vector<string> targets = strings::SplitString(rule->rule(), " ");
+    targets.insert(targets.end(),
+                   rule->outputs().begin(), rule->outputs().end());
+    int index = -1;
+    for (const string& target : targets) {
+      auto it = action_index_.find(target);
+      if (it != action_index_.end()) {
+        index = it->second;
+        break;
+      }
+    }
+    if (index < 0) {
+      index = actions_.size();
+      actions_.push_back(Action());
+      actions_.back().target = targets[0];
+      actions_.back().node = node;
+      node_actions.push_back(index);
+    }
+    Action* action = &actions_[index];
+    for (const string& target : targets) {
+      action_index_.insert(std::make_pair(target, index));
+      auto it = durations_.find(target);
+      if (it != durations_.end()) {
+        action->duration = std::max(action->duration, it->second);
+        action->timed = true;
+      }
+    }
+    vector<string>* inputs = &prerequisites[index];
+    for (const string& input : strings::SplitString(rule->dependencies(),
+                                                    " ")) {
+      if (!input.empty() && input != "|" && input[0] != '$') {
+        inputs->push_back(input);
+      }
+    }
+  }
+
+  // Inputs may name any rule added so far, including later ones of ours.
+  for (const auto& it : prerequisites) {
+    Action* action = &actions_[it.first];
+    set<int> seen(action->inputs.begin(), action->inputs.end());
+    for (const string& input : it.second) {
+      auto found = action_index_.find(input);
+      if (found != action_index_.end() && found->second != it.first &&
+          seen.insert(found->second).second) {
+        action->inputs.push_back(found->second);
+      }
+    }
+  }
+  for (int index : node_actions) {
+    Action* action = &actions_[index];
+    if (!action->inputs.empty()) {
+      continue;
+    }
+    for (const Node* dependency : node->dependencies()) {
+      auto it = node_end_.find(dependency);
+      if (it != node_end_.end()) {
+        action->inputs.push_back(it->second);
+      }
+    }
+  }
+
+  int end = actions_.size();
+  actions_.push_back(Action());
+  actions_.back().node = node;
+  actions_.back().inputs = node_actions;
+  node_end_[node] = end;
+  order_.clear();
+}
+
+void CriticalPath::Sort(int action, vector<int>* state) const {
+  if ((*state)[action] != UNVISITED) {
+    if ((*state)[action] == VISITING) {
+      LOG(WARNING) << "Dependency cycle through " << actions_[action].target;
+    }
+    return;
+  }
+  (*state)[action] = VISITING;
+  for (int input : actions_[action].inputs) {
+    Sort(input, state);
+  }
+  (*state)[action] = VISITED;
+  order_.push_back(action);
+}
+
+int64_t CriticalPath::EarliestFinish(int free_action,
+                                     vector<int64_t>* finish) const {
+  if (order_.empty()) {
+    vector<int> state(actions_.size(), UNVISITED);
+    for (int i = 0; i < actions_.size(); ++i) {
+      Sort(i, &state);
+    }
+  }
+  finish->assign(actions_.size(), 0);
+  int64_t length = 0;
+  for (int index : order_) {
+    const Action& action = actions_[index];
+    int64_t start = 0;
+    for (int input : action.inputs) {
+      start = std::max(start, (*finish)[input]);
+    }
+    (*finish)[index] = start + (index == free_action ? 0 : action.duration);
+    length = std::max(length, (*finish)[index]);
+  }
+  return length;
+}
+
+string CriticalPath::Report() const {
+  vector<int64_t> finish;
+  int64_t length = EarliestFinish(-1, &finish);
+
+  // Latest each action can finish without delaying the build.
+  vector<int64_t> latest(actions_.size(), length);
+  for (int i = order_.size() - 1; i >= 0; --i) {
+    const Action& action = actions_[order_[i]];
+    int64_t start = latest[order_[i]] - action.duration;
+    for (int input : action.inputs) {
+      latest[input] = std::min(latest[input], start);
+    }
+  }
+
+  // Walk back from the action that finishes last.
+  vector<int> path;
+  int current = -1;
+  for (int i = 0; i < actions_.size(); ++i) {
+    if (current < 0 || finish[i] > finish[current]) {
+      current = i;
+    }
+  }
+  while (current >= 0) {
+    if (!actions_[current].target.empty()) {
+      path.push_back(current);
+    }
+    const Action& action = actions_[current];
+    int64_t start = finish[current] - action.duration;
+    current = -1;
+    for (int input : action.inputs) {
+      if (finish[input] == start) {
+        current = input;
+        break;
+      }
+    }
+  }
+  std::reverse(path.begin(), path.end());
+
+  int64_t total = 0;
+  int timed = 0, real = 0;
+  for (const Action& action : actions_) {
+    if (!action.target.empty()) {
+      ++real;
+      timed += action.timed;
+      total += action.duration;
+    }
+  }
+
+  string out = "Critical path: " + Seconds(length) + " (" +
+      Seconds(total) + " of work, " +
+      strings::StringPrintf("%d of %d actions timed)\n", timed, real);
+  for (int index : path) {
+    const Action& action = actions_[index];
+    out += strings::StringPrintf(
+        "  %9s %9s  %s  %s%s\n",
+        Seconds(finish[index] - action.duration).c_str(),
+        Seconds(action.duration).c_str(),
+        action.node->target().full_path().c_str(),
+        action.target.c_str(),
+        action.timed ? "" : " (not timed)");
+  }
+
+  // A node has the slack of its least flexible action.
+  out += "\nSlack by target:\n";
+  map<const Node*, int64_t> node_slack;
+  for (int i = 0; i < actions_.size(); ++i) {
+    int64_t slack = latest[i] - finish[i];
+    auto it = node_slack.find(actions_[i].node);
+    if (it == node_slack.end() || slack < it->second) {
+      node_slack[actions_[i].node] = slack;
+    }
+  }
+  vector<std::pair<int64_t, string> > slacks;
+  for (const auto& it : node_slack) {
+    slacks.push_back(std::make_pair(it.second, it.first->target().full_path()));
+  }
+  std::sort(slacks.begin(), slacks.end());
+  for (const auto& it : slacks) {
+    out += strings::StringPrintf("  %9s  %s\n", Seconds(it.first).c_str(),
+                                 it.second.c_str());
+  }
+
+  // Another chain may take over when one action gets faster.
+  out += "\nIf an action on the critical path took no time:\n";
+  vector<std::pair<int64_t, int> > savings;
+  for (int index : path) {
+    vector<int64_t> scratch;
+    savings.push_back(std::make_pair(length - EarliestFinish(index, &scratch),
+                                index));
+  }
+  std::stable_sort(savings.rbegin(), savings.rend());
+  for (const auto& it : savings) {
+    if (it.first <= 0) {
+      continue;
+    }
+    int64_t remaining = std::max<int64_t>(length - it.first, 1);
+    out += strings::StringPrintf(
+        "  %9s  %5.1fx  %s\n",
+        Seconds(it.first).c_str(),
+        static_cast<double>(length) / remaining,
+        actions_[it.second].target.c_str());
+  }
+  return out;
+}
+
+}  // namespace repobuild
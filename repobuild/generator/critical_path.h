@@ -0,0 +1,73 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// CriticalPath
+//  Weighs every action (make rule) of a build with its last recorded
+//  duration (see action_log.h) and finds the longest chain through them,
+//  which bounds the wall time of a clean build however many jobs we run.
+//
+//  Actions depend on the rules named in their prerequisites. Prerequisites
+//  we cannot resolve (make variables, source files) are covered by the node
+//  graph instead: an action with no known inputs waits for every action of
+//  the nodes its node depends on.
+
+#ifndef _REPOBUILD_GENERATOR_CRITICAL_PATH_H__
+#define _REPOBUILD_GENERATOR_CRITICAL_PATH_H__
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "common/base/macros.h"
+
+namespace repobuild {
+
+class Input;
+class Node;
+
+class CriticalPath {
+ public:
+  // 'durations' are in microseconds, by make target. Actions that were
+  // never timed take no time.
+  CriticalPath(const Input& input,
+               const std::map<std::string, int64_t>& durations);
+  ~CriticalPath();
+
+  // Adds the actions of 'node', after those of its dependencies.
+  void AddNode(const Node* node);
+
+  // The critical path, the slack of every node, and how much faster the
+  // build would be if each action on the critical path took no time.
+  std::string Report() const;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(CriticalPath);
+
+  struct Action {
+    Action() : node(NULL), duration(0), timed(false) {}
+
+    std::string target;  // empty for the end of a node.
+    const Node* node;
+    int64_t duration;
+    bool timed;
+    std::vector<int> inputs;
+  };
+
+  // Orders actions so every input comes first.
+  void Sort(int action, std::vector<int>* state) const;
+
+  // The earliest each action can finish, if 'free_action' (unless -1)
+  // took no time. Returns the length of the critical path.
+  int64_t EarliestFinish(int free_action, std::vector<int64_t>* finish) const;
+
+  const Input& input_;
+  const std::map<std::string, int64_t>& durations_;
+  std::vector<Action> actions_;
+  std::map<std::string, int> action_index_;  // by make target.
+  std::map<const Node*, int> node_end_;  // waits for all of a node's actions.
+  mutable std::vector<int> order_;
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_GENERATOR_CRITICAL_PATH_H__
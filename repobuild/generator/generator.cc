@@ -2,20 +2,27 @@
 // Author: Christopher Van Arsdale
 
 #include <iostream>
+#include <map>
 #include <set>
 #include <vector>
 #include <string>
 #include "common/log/log.h"
+#include "common/strings/path.h"
 #include "common/strings/strutil.h"
 #include "common/util/stl.h"
 #include "repobuild/distsource/dist_source.h"
 #include "repobuild/env/input.h"
 #include "repobuild/env/resource.h"
+#include "repobuild/generator/action_log.h"
+#include "repobuild/generator/critical_path.h"
 #include "repobuild/generator/generator.h"
+#include "repobuild/generator/ninja.h"
 #include "repobuild/nodes/allnodes.h"
+#include "repobuild/nodes/makefile.h"
 #include "repobuild/nodes/node.h"
 #include "repobuild/reader/parser.h"
 
+using std::map;
 using std::string;
 using std::vector;
 using std::set;
@@ -48,6 +55,55 @@ void ExpandNode(const Parser& parser,
   to_process->push_back(node);
 }
 
+// Orders the nodes of 'parser' so each one follows its dependencies.
+void ProcessOrder(const Parser& parser, vector<const Node*>* process_order) {
+  set<const Node*> parents, seen;
+  for (const Node* node : parser.input_nodes()) {
+    ExpandNode(parser, node, &parents, &seen, process_order);
+  }
+}
+
+// Where the makefiles of 'node's package go, under 'fragment_dir'.
+string FragmentDir(const string& fragment_dir, const Node* node) {
+  return strings::JoinPath(fragment_dir, node->target().dir());
+}
+
+// Includes the package makefiles under 'fragment_dir': only those of the
+// packages the goals depend on when every goal is a target, otherwise
+// ("all", files, ...) all of them. Variables first, as rules may use them.
+void WriteFragmentIncludes(const string& fragment_dir,
+                           const vector<const Node*>& process_order,
+                           Makefile* out) {
+  vector<string> dirs;
+  set<string> seen_dirs;
+  map<const Node*, set<string> > packages;
+  string target_dirs;
+  for (const Node* node : process_order) {
+    string dir = FragmentDir(fragment_dir, node);
+    if (seen_dirs.insert(dir).second) {
+      dirs.push_back(dir);
+    }
+    // Dependencies come first in 'process_order'.
+    set<string>* node_dirs = &packages[node];
+    node_dirs->insert(dir);
+    for (const Node* dep : node->dependencies()) {
+      const set<string>& dep_dirs = packages[dep];
+      node_dirs->insert(dep_dirs.begin(), dep_dirs.end());
+    }
+    target_dirs += "repobuild_fragments." + node->target().make_path() +
+        " := " + strings::JoinAll(*node_dirs, " ") + "\n";
+  }
+  out->append("# Package makefiles.\n");
+  out->append("repobuild_fragments := " + strings::JoinAll(dirs, " ") + "\n");
+  out->append(target_dirs);
+  // $(filter) keeps the order above, and each package once.
+  out->append("repobuild_read := $(filter $(foreach goal,"
+              "$(or $(MAKECMDGOALS),all),$(or $(repobuild_fragments.$(goal)),"
+              "$(repobuild_fragments))),$(repobuild_fragments))\n");
+  out->append("include $(addsuffix /.variables.mk,$(repobuild_read))\n");
+  out->append("include $(addsuffix /BUILD.mk,$(repobuild_read))\n\n");
+}
+
 }  // anonymous namespace
 
 Generator::Generator(DistSource* source)
@@ -57,7 +113,26 @@ Generator::Generator(DistSource* source)
 Generator::~Generator() {
 }
 
+void Generator::SetNinjaFile(const string& makefile,
+                             const string& ninja_file) {
+  makefile_ = makefile;
+  ninja_file_ = ninja_file;
+}
+
+void Generator::SetActionGraphFile(const string& makefile,
+                                   const string& graph_file) {
+  makefile_ = makefile;
+  action_graph_file_ = graph_file;
+}
+
 string Generator::GenerateMakefile(const Input& input) {
+  return GenerateMakefile(input, "", NULL);
+}
+
+string Generator::GenerateMakefile(const Input& input,
+                                   const string& fragment_dir,
+                                   map<string, string>* fragments) {
+  bool split = !fragment_dir.empty();
   // Our set of node types (cc_library, etc.).
   NodeBuilderSet builder_set;
 
@@ -65,27 +140,52 @@ string Generator::GenerateMakefile(const Input& input) {
   Makefile out(input.root_dir(), input.genfile_dir());
   out.SetSilent(input.silent_make());
   out.append("# Auto-generated by repobuild, do not modify directly.\n\n");
+  for (const string& pool : Makefile::ResourceClasses()) {
+    if (pool != "cpu") {
+      auto it = pool_depths_.find(pool);
+      out.append(strings::StringPrintf(
+          "%s ?= %d\n", Makefile::PoolDepthVariable(pool).c_str(),
+          it == pool_depths_.end() ? 1 : it->second));
+    }
+  }
+  out.append("\n");
   builder_set.WriteMakeHead(input, &out);
   source_->WriteMakeHead(input, &out);
+  if (input.time_actions()) {
+    ActionLog::WriteMakeTimer(input, &out);
+  }
 
   // Get our input tree of nodes.
   repobuild::Parser parser(&builder_set, source_);
   parser.Parse(input);
 
   // Figure out the order we want to write in our Makefile.
-  set<const Node*> parents, seen;
   vector<const Node*> process_order;
-  for (const Node* node : parser.input_nodes()) {
-    ExpandNode(parser, node, &parents, &seen, &process_order);
-  }
+  ProcessOrder(parser, &process_order);
 
   std::cout << "Generating: Makefile" << std::endl;
 
-  // Generate the makefile.
+  // Generate the makefile. Rules may reference any node's variables, so
+  // those all go first.
+  if (split) {
+    WriteFragmentIncludes(fragment_dir, process_order, &out);
+  }
+  for (const Node* node : process_order) {
+    if (split) {
+      out.StartFragment(strings::JoinPath(FragmentDir(fragment_dir, node),
+                                          ".variables.mk"));
+    }
+    node->WriteMakeVariables(&out);
+  }
   for (const Node* node : process_order) {
     VLOG(1) << "Writing make: " << node->target().full_path();
-    node->WriteMake(&out);
+    if (split) {
+      out.StartFragment(strings::JoinPath(FragmentDir(fragment_dir, node),
+                                          "BUILD.mk"));
+    }
+    node->WriteMakeRules(&out);
   }
+  out.EndFragment();
 
   // Finish up node make files
   builder_set.FinishMakeFile(input, process_order, source_, &out);
@@ -101,7 +201,16 @@ string Generator::GenerateMakefile(const Input& input) {
   source_->WriteMakeClean(clean);
   clean->WriteCommand("rm -rf " + input.object_dir());
   clean->WriteCommand("rm -rf " + input.binary_dir());
-  clean->WriteCommand("rm -rf " + input.genfile_dir());
+  if (split && strings::HasPrefix(fragment_dir, input.genfile_dir() + "/")) {
+    // Keep our fragments, the makefile cannot be read without them.
+    string keep = fragment_dir.substr(input.genfile_dir().size() + 1);
+    keep = keep.substr(0, keep.find('/'));
+    clean->WriteCommand("find " + input.genfile_dir() + " -mindepth 1 "
+                        "-maxdepth 1 ! -name " + keep +
+                        " -exec rm -rf {} +");
+  } else {
+    clean->WriteCommand("rm -rf " + input.genfile_dir());
+  }
   clean->WriteCommand("rm -rf " + input.source_dir());
   clean->WriteCommand("rm -rf " + input.pkgfile_dir());
   out.FinishRule(clean);
@@ -167,7 +276,40 @@ string Generator::GenerateMakefile(const Input& input) {
   // And finalize.
   out.FinishMakefile();
 
+  if (fragments != NULL) {
+    *fragments = out.fragments();
+    if (!ninja_file_.empty()) {
+      string expand_file = NinjaWriter::ExpandFile(input.genfile_dir(),
+                                                   ninja_file_);
+      NinjaWriter ninja(makefile_, ninja_file_, expand_file);
+      (*fragments)[expand_file] = ninja.ExpandMakefile(out);
+      (*fragments)[ninja_file_] = ninja.Bootstrap();
+    }
+    if (!action_graph_file_.empty()) {
+      string expand_file = NinjaWriter::ExpandFile(input.genfile_dir(),
+                                                   action_graph_file_);
+      NinjaWriter ninja(makefile_, action_graph_file_, expand_file);
+      (*fragments)[expand_file] = ninja.ExpandMakefile(out);
+    }
+  }
   return out.out();
 }
 
+string Generator::CriticalPathReport(const Input& input,
+                                     const ActionLog& log) {
+  NodeBuilderSet builder_set;
+  repobuild::Parser parser(&builder_set, source_);
+  parser.Parse(input);
+  vector<const Node*> process_order;
+  ProcessOrder(parser, &process_order);
+
+  map<string, int64_t> durations;
+  log.LatestDurations(&durations);
+  CriticalPath path(input, durations);
+  for (const Node* node : process_order) {
+    path.AddNode(node);
+  }
+  return path.Report();
+}
+
 }  // namespace repobuild
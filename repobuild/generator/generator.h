@@ -4,10 +4,12 @@
 #ifndef _REPOBUILD_GENERATOR_GENERATOR_H__
 #define _REPOBUILD_GENERATOR_GENERATOR_H__
 
+#include <map>
 #include <string>
 
 namespace repobuild {
 
+class ActionLog;
 class DistSource;
 class Input;
 class Parser;
@@ -17,10 +19,43 @@ class Generator {
   explicit Generator(DistSource* source);
   ~Generator();
 
+  // How many rules of each pool (see Makefile::ResourceClasses()) may run
+  // at once, 1 if not given. They are the defaults of the POOL_DEPTH.<pool>
+  // make variables, which make, ninja and "repobuild build" all use.
+  void SetPoolDepths(const std::map<std::string, int>& depths) {
+    pool_depths_ = depths;
+  }
+
+  // Also write a ninja manifest of the same rules to 'ninja_file' (see
+  // ninja.h), built from the makefile at 'makefile'. It is returned along
+  // with the fragments.
+  void SetNinjaFile(const std::string& makefile,
+                    const std::string& ninja_file);
+
+  // Likewise for 'graph_file', but without the bootstrap: the caller runs
+  // NinjaWriter::ExpandCommand() whenever the manifest is out of date (see
+  // executor/executor.h).
+  void SetActionGraphFile(const std::string& makefile,
+                          const std::string& graph_file);
+
   std::string GenerateMakefile(const Input& input);
 
+  // As above, but the variables and the rules of each package go into
+  // separate makefiles under 'fragment_dir'. The returned makefile includes
+  // only those its goals need. 'fragments' is filled with (file path, contents), including
+  // any ninja files.
+  std::string GenerateMakefile(const Input& input,
+                               const std::string& fragment_dir,
+                               std::map<std::string, std::string>* fragments);
+
+  // Reads BUILD files like GenerateMakefile, and reports the critical path
+  // (see critical_path.h) of the input targets with the durations in 'log'.
+  std::string CriticalPathReport(const Input& input, const ActionLog& log);
+
  private:
   DistSource* source_;  // not owned
+  std::string makefile_, ninja_file_, action_graph_file_;
+  std::map<std::string, int> pool_depths_;
 };
 
 }  // namespace repobuild
@@ -0,0 +1,279 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+
+#include <string.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "common/log/log.h"
+#include "common/strings/path.h"
+#include "common/strings/strutil.h"
+#include "repobuild/generator/ninja.h"
+#include "repobuild/nodes/makefile.h"
+
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace repobuild {
+namespace {
+const char kExpandTarget[] = "repobuild_ninja";
+
+// One ninja build statement, possibly merged from several make rules for the
+// same targets (make allows one recipe plus any number of dependency lines).
+struct Edge {
+  Edge() : rule(NULL) {}
+
+  void AddInputs(const string& paths, vector<string>* list) {
+    for (const string& path : strings::SplitString(paths, " ")) {
+      if (seen.insert(path).second) {
+        list->push_back(path);
+      }
+    }
+  }
+
+  vector<string> outputs, inputs, order_only;
+  set<string> seen;  // inputs.
+  const Makefile::Rule* rule;  // the one with commands, if any.
+};
+
+// Make expands automatic variables in recipes only, our commands are
+// expanded outside of one. 'first' is the recipe's first prerequisite.
+string ReplaceAutomaticVariables(const string& command, const Edge& edge,
+                                 const string& first) {
+  string output;
+  for (int i = 0; i < command.size(); ++i) {
+    if (command[i] != '$' || i + 1 == command.size()) {
+      output += command[i];
+      continue;
+    }
+    char next = command[++i];
+    if (next == '@') {
+      output += edge.outputs[0];
+    } else if (next == '<') {
+      output += first;
+    } else if (next == '^' || next == '+') {
+      output += strings::JoinAll(edge.inputs, " ");
+    } else if (next == '|') {
+      output += strings::JoinAll(edge.order_only, " ");
+    } else if (next == '$') {
+      output += "$$";
+    } else {
+      // $* and $? have no ninja equivalent, nor do $(@D) and friends.
+      CHECK(next != '*' && next != '?' &&
+            !((next == '(' || next == '{') && i + 1 < command.size() &&
+              strchr("@<^+|*?", command[i + 1]) != NULL))
+          << "Automatic variable not supported with ninja: " << command;
+      output += '$';
+      output += next;
+    }
+  }
+  return output;
+}
+
+// 'path' is as written in the makefile, where '$$' is a literal '$'. Once
+// make expands the manifest, ninja (and ActionGraph) must see '$$', '$ '
+// and '$:' for '$', spaces and colons.
+string NinjaPath(const string& path) {
+  string output;
+  for (int i = 0; i < path.size(); ++i) {
+    if (path[i] == '$' && i + 1 < path.size() && path[i + 1] == '$') {
+      output += "$$$$";
+      ++i;
+    } else if (path[i] == ' ' || path[i] == ':') {
+      output += "$$";
+      output += path[i];
+    } else {
+      output += path[i];
+    }
+  }
+  return output;
+}
+
+string NinjaPaths(const vector<string>& paths) {
+  vector<string> escaped;
+  for (const string& path : paths) {
+    escaped.push_back(NinjaPath(path));
+  }
+  return strings::JoinAll(escaped, " ");
+}
+}  // anonymous namespace
+
+NinjaWriter::NinjaWriter(const string& makefile,
+                         const string& ninja_file,
+                         const string& expand_file)
+    : makefile_(makefile),
+      ninja_file_(ninja_file),
+      expand_file_(expand_file) {
+}
+
+string NinjaWriter::ExpandMakefile(const Makefile& makefile) const {
+  // Merge rules by target.
+  vector<Edge> edges;
+  map<string, int> edge_index;
+  for (const std::unique_ptr<Makefile::Rule>& rule : makefile.rules()) {
+    vector<string> targets = strings::SplitString(rule->rule(), " ");
+    targets.insert(targets.end(),
+                   rule->outputs().begin(), rule->outputs().end());
+    int index = -1;
+    for (const string& target : targets) {
+      auto it = edge_index.find(target);
+      if (it != edge_index.end()) {
+        index = it->second;
+        break;
+      }
+    }
+    if (index < 0) {
+      index = edges.size();
+      edges.push_back(Edge());
+    }
+    Edge* edge = &edges[index];
+    for (const string& target : targets) {
+      if (!target.empty() &&
+          edge_index.insert(make_pair(target, index)).second) {
+        edge->outputs.push_back(target);
+      }
+    }
+    // Order-only prerequisites follow a '|'.
+    const string& dependencies = rule->dependencies();
+    size_t pos = dependencies.find('|');
+    edge->AddInputs(dependencies.substr(0, pos), &edge->inputs);
+    if (pos != string::npos) {
+      edge->AddInputs(dependencies.substr(pos + 1), &edge->order_only);
+    }
+    if (edge->rule == NULL && !rule->commands().empty()) {
+      edge->rule = rule.get();
+    }
+  }
+
+  string out = string("# Auto-generated by repobuild, do not modify "
+                      "directly.\n# \"make -f ") +
+      expand_file_ + " " + kExpandTarget + "\" writes " + ninja_file_ + ".\n\n"
+      "include " + makefile_ + "\n\n";
+
+  // Commands are defined verbatim, and escaped for ninja once expanded.
+  string manifest;
+  set<string> pools;
+  for (int i = 0; i < edges.size(); ++i) {
+    const Edge& edge = edges[i];
+    const Makefile::Rule* rule = edge.rule;
+    if (edge.outputs.empty()) {
+      continue;
+    }
+
+    string ninja_rule = "phony";
+    if (rule != NULL) {
+      ninja_rule = (!rule->depfile().empty() ? "run_deps" :
+                    rule->restat() ? "run_restat" : "run");
+    }
+    manifest += "\nbuild " + NinjaPaths(edge.outputs) + ": " +
+        strings::JoinWith(" ", ninja_rule, NinjaPaths(edge.inputs));
+    if (!edge.order_only.empty()) {
+      manifest += " || " + NinjaPaths(edge.order_only);
+    }
+    manifest += "\n";
+    if (rule == NULL) {
+      continue;
+    }
+
+    string command_variable =
+        strings::StringPrintf("repobuild_ninja.cmd.%d", i);
+    // Make's $< is the first prerequisite of the rule with the recipe.
+    string first;
+    const string& dependencies = rule->dependencies();
+    for (const string& path : strings::SplitString(
+             dependencies.substr(0, dependencies.find('|')), " ")) {
+      if (!path.empty()) {
+        first = path;
+        break;
+      }
+    }
+    string command;
+    for (const string& line : rule->commands()) {
+      command = strings::JoinWith(
+          " && ", command,
+          "(" + ReplaceAutomaticVariables(line, edge, first) + ")");
+    }
+    out += "define " + command_variable + "\n" + command + "\nendef\n";
+    manifest += "  cmd = $(subst $$,$$$$,$(" + command_variable + "))\n";
+    if (!rule->depfile().empty()) {
+      manifest += "  depfile = " + NinjaPath(rule->depfile()) + "\n";
+    }
+    if (!rule->pool().empty()) {
+      manifest += "  pool = " + rule->pool() + "\n";
+      pools.insert(rule->pool());
+    }
+    if (!rule->kind().empty()) {
+      // Unused by ninja, but "repobuild build" reports them.
+      manifest += "  kind = " + rule->kind() + "\n";
+      manifest += "  label = " + rule->label() + "\n";
+    }
+    if (rule->cacheable()) {
+      manifest += "  cacheable = 1\n";  // likewise, see ActionCache.
+    }
+  }
+  if (makefile.seen_rule("all")) {
+    manifest += "\ndefault all\n";
+  }
+
+  string header = "ninja_required_version = 1.3\n";
+  for (const string& pool : pools) {
+    header += "\npool " + pool + "\n  depth = $(" +
+        Makefile::PoolDepthVariable(pool) + ")\n";
+  }
+  header += "\nrule run\n  command = $$cmd\n  description = $$out\n"
+      "\nrule run_restat\n  command = $$cmd\n  description = $$out\n"
+      "  restat = 1\n"
+      "\nrule run_deps\n  command = $$cmd\n  description = $$out\n"
+      "  depfile = $$depfile\n  deps = gcc\n\n" + RegenerateRule();
+
+  out += "\ndefine repobuild_ninja\n" + header + manifest + "endef\n\n";
+  out += ".PHONY: " + string(kExpandTarget) + "\n";
+  out += string(kExpandTarget) + ":\n";
+  out += "\t$(file >" + ninja_file_ + ".tmp,$(repobuild_ninja))\n";
+  out += "\t@mv -f " + ninja_file_ + ".tmp " + ninja_file_ + "\n";
+  return out;
+}
+
+string NinjaWriter::Bootstrap() const {
+  // The phony input with no inputs of its own is always dirty, so ninja
+  // expands the real manifest before doing anything else.
+  return string("# Auto-generated by repobuild, do not modify directly.\n"
+                "# Ninja replaces this file on its first run, see ") +
+      expand_file_ +
+      ".\n\n"
+      "ninja_required_version = 1.3\n\n"
+      "rule " + kExpandTarget + "\n"
+      "  command = " + ExpandCommand() + "\n"
+      "  description = Expanding " + ninja_file_ + "\n"
+      "  generator = 1\n\n"
+      "build " + expand_file_ + ".force: phony\n"
+      "build " + ninja_file_ + ": " + kExpandTarget + " " + expand_file_ +
+      " | " + expand_file_ + ".force\n";
+}
+
+string NinjaWriter::ExpandCommand() const {
+  return "make -s -f " + expand_file_ + " " + kExpandTarget;
+}
+
+// static
+string NinjaWriter::ExpandFile(const string& genfile_dir,
+                               const string& ninja_file) {
+  return strings::JoinPath(strings::JoinPath(genfile_dir, "mk"),
+                           strings::PathBasename(ninja_file) + ".mk");
+}
+
+string NinjaWriter::RegenerateRule() const {
+  // Re-expand when any makefile we read changes, except compiler depfiles.
+  return string("rule ") + kExpandTarget + "\n"
+      "  command = $(MAKE) -s -f " + expand_file_ + " " + kExpandTarget + "\n"
+      "  description = Expanding " + ninja_file_ + "\n"
+      "  generator = 1\n\n"
+      "build " + ninja_file_ + ": " + kExpandTarget +
+      " $(filter-out %.d,$(MAKEFILE_LIST))\n";
+}
+
+}  // namespace repobuild
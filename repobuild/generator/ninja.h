@@ -0,0 +1,58 @@
+// Copyright 2013
+// Author: Christopher Van Arsdale
+//
+// NinjaWriter
+//  Writes a ninja manifest for the rules of a generated Makefile. Those rules
+//  are full of make variables and functions that ninja cannot expand, so we
+//  write a makefile that includes the generated one and expands every rule
+//  into ninja syntax with $(file ...) (GNU make 4.0+). The bootstrap manifest
+//  only runs that expansion, which ninja does before its first build; after
+//  that, ninja re-expands whenever one of the makefiles changes.
+//
+//  Depfiles map to "deps = gcc", restat rules to "restat = 1" and pools to
+//  ninja pools, as deep as their POOL_DEPTH.<pool> make variables.
+
+#ifndef _REPOBUILD_GENERATOR_NINJA_H__
+#define _REPOBUILD_GENERATOR_NINJA_H__
+
+#include <string>
+#include "common/base/macros.h"
+
+namespace repobuild {
+
+class Makefile;
+
+class NinjaWriter {
+ public:
+  // Paths are relative to the root. 'expand_file' is where the caller writes
+  // ExpandMakefile().
+  NinjaWriter(const std::string& makefile,
+              const std::string& ninja_file,
+              const std::string& expand_file);
+  ~NinjaWriter() {}
+
+  // Contents of 'expand_file', for the rules of 'makefile'.
+  std::string ExpandMakefile(const Makefile& makefile) const;
+
+  // Initial contents of 'ninja_file'.
+  std::string Bootstrap() const;
+
+  // Writes 'ninja_file' from 'expand_file', run from the root.
+  std::string ExpandCommand() const;
+
+  // Where 'expand_file' goes for 'ninja_file', by convention.
+  static std::string ExpandFile(const std::string& genfile_dir,
+                                const std::string& ninja_file);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(NinjaWriter);
+
+  // The ninja rule that (re)writes 'ninja_file'.
+  std::string RegenerateRule() const;
+
+  std::string makefile_, ninja_file_, expand_file_;
+};
+
+}  // namespace repobuild
+
+#endif  // _REPOBUILD_GENERATOR_NINJA_H__
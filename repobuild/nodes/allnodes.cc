@@ -83,6 +83,7 @@ void NodeBuilder::GetAll(std::vector<NodeBuilder*>* nodes) {
       "cc_shared_library"));
   nodes->push_back(new NodeBuilderImplHead<PyBinaryNode>("py_egg"));
   nodes->push_back(new NodeBuilderImplHead<CCEmbedDataNode>("cc_embed_data"));
+  nodes->push_back(new NodeBuilderImplHead<JavaLibraryNode>("java_library"));
 
   nodes->push_back(new NodeBuilderImpl<AutoconfNode>("autoconf"));
   nodes->push_back(new NodeBuilderImpl<CCBinaryNode>("cc_binary"));
@@ -90,7 +91,6 @@ void NodeBuilder::GetAll(std::vector<NodeBuilder*>* nodes) {
   nodes->push_back(new NodeBuilderImpl<ConfigNode>("config"));
   nodes->push_back(new NodeBuilderImpl<GoLibraryNode>("go_library"));
   nodes->push_back(new NodeBuilderImpl<GoBinaryNode>("go_binary"));
-  nodes->push_back(new NodeBuilderImpl<JavaLibraryNode>("java_library"));
   nodes->push_back(new NodeBuilderImpl<JavaJarNode>("java_jar"));
   nodes->push_back(new NodeBuilderImpl<JavaBinaryNode>("java_binary"));
   nodes->push_back(new NodeBuilderImpl<MakeNode>("make"));
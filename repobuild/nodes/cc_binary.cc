@@ -4,6 +4,7 @@
 // TODO(cvanarsdale): This overalaps with cc_shared_library.
 
 #include <algorithm>
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
@@ -15,6 +16,7 @@
 #include "repobuild/nodes/top_symlink.h"
 #include "repobuild/reader/buildfile.h"
 
+using std::map;
 using std::string;
 using std::vector;
 using std::set;
@@ -38,43 +40,17 @@ void CCBinaryNode::LocalWriteMake(Makefile* out) const {
   WriteBaseUserTarget(out);
 }
 
-/**
- * Adds to "has_tag" each Resource in "fileset" that has "tag".
- * Adds to "no_tag" each Resource in "fileset" that does not have "tag".
- */
-static void Partition(const ResourceFileSet& fileset,
-		      const string& tag,
-		      ResourceFileSet* has_tag,
-		      ResourceFileSet* no_tag) {
-  for (auto it : fileset) {
-    if (it.has_tag(tag)) {
-      has_tag->Add(it);
-    } else {
-      no_tag->Add(it);
-    }
-  }
-}
-
 void CCBinaryNode::WriteLink(const Resource& file, Makefile* out) const {
   ResourceFileSet objects;
   ObjectFiles(CPP, &objects);
-
-  ResourceFileSet ephemeral_objects, normal_objects;
-  Partition(objects, "ephemeral", &ephemeral_objects, &normal_objects);
+  WriteEphemeralCompiles(file, &objects, out);
 
   set<string> flags;
   LinkFlags(CPP, &flags);
 
   // Link rule
   Makefile::Rule* rule =
-    out->StartRule(file.path(), strings::JoinAll(normal_objects.files(), " "));
-
-  string ephemeral_targets = strings::JoinAll(ephemeral_objects.files(), " ");
-  if (!ephemeral_targets.empty()) {
-    rule->WriteUserEcho("Making ephemeral inputs", ephemeral_targets);
-    rule->WriteCommand("make " + ephemeral_targets);
-  }
-
+    out->StartRule(file.path(), strings::JoinAll(objects.files(), " "));
   rule->WriteUserEcho("Linking", file.path());
 
   // HACK(cvanarsdale):
@@ -101,6 +77,8 @@ void CCBinaryNode::WriteLink(const Resource& file, Makefile* out) const {
       " ",
       "$(LINK.cc)", obj_list, "-o", file,
       strings::JoinAll(flags, " ")));
+  rule->SetCacheable();
+  SetResourceClass("link", rule);
   out->FinishRule(rule);
 }
 
@@ -1,6 +1,8 @@
 // Copyright 2013
 // Author: Christopher Van Arsdale
 
+#include <cstring>
+#include <map>
 #include <string>
 #include <set>
 #include <iterator>
@@ -13,6 +15,7 @@
 #include "repobuild/nodes/util.h"
 #include "repobuild/reader/buildfile.h"
 
+using std::map;
 using std::vector;
 using std::string;
 using std::set;
@@ -27,6 +30,16 @@ const char kCHeaderArgs[] = "c_header_compile_args";
 const char kCxxHeaderArgs[] = "cxx_header_compile_args";
 const char kCGcc[] = "CC_GCC";
 const char kCxxGcc[] = "CXX_GCC";
+const char kIsDarwin[] = "IS_DARWIN";
+const char kToolchainConfig[] = "TOOLCHAIN_CONFIG";
+const char kCFlags[] = "c_flags";
+const char kCxxFlags[] = "cxx_flags";
+const char kEphemeralInputs[] = ".inputs";
+
+bool IsCppSource(const Resource& source) {
+  return (strings::HasSuffix(source.basename(), ".cc") ||
+          strings::HasSuffix(source.basename(), ".cpp"));
+}
 }
 
 void CCLibraryNode::Parse(BuildFile* file, const BuildFileNode& input) {
@@ -166,70 +179,176 @@ void CCLibraryNode::LocalWriteMake(Makefile* out) const {
 
 void CCLibraryNode::LocalWriteMakeInternal(bool should_write_target,
                                            Makefile* out) const {
-  // Figure out the set of input files.
+  // Figure out the set of input files: our headers, plus the interface
+  // stamps (or files) of our direct dependencies.
   ResourceFileSet input_files;
-  InputDependencyFiles(CPP, &input_files);  // any object files/headers/etc.
-  CCLibraryNode::LocalDependencyFiles(CPP, &input_files);  // our headers
+  InputDependencyFiles(CPP, &input_files);
+  if (HasVariable(kHeaderVariable)) {
+    input_files.Add(Resource::FromRaw(GetVariable(kHeaderVariable).ref_name()));
+  }
+  WriteInterfaceStamp(input_files, out);
+
+  // Include dirs and flags are the same for every source of a language.
+  bool has_cpp = false, has_c = false;
+  for (const Resource& source : sources_) {
+    if (IsCppSource(source)) {
+      has_cpp = true;
+    } else {
+      has_c = true;
+    }
+  }
+  if (has_cpp) {
+    WriteCompileFlags(CPP, out);
+  }
+  if (has_c) {
+    WriteCompileFlags(C_LANG, out);
+  }
 
   // Now write phases, one per .cc
+  ResourceFileSet interface;
+  interface.Add(InterfaceStamp());
   for (int i = 0; i < sources_.size(); ++i) {
     // Output object.
-    WriteCompile(sources_[i], input_files, out);
+    WriteCompile(sources_[i], interface, out);
   }
 
   // Now write user target (so users can type "make path/to/exec|lib").
   if (should_write_target) {
     ResourceFileSet targets;
     for (const Resource& source : sources_) {
-      targets.Add(ObjForSource(source));
+      targets.Add(OutputForSource(source));
     }
     WriteBaseUserTarget(targets, out);
   }
 }
 
+void CCLibraryNode::WriteInterfaceStamp(const ResourceFileSet& input_files,
+                                        Makefile* out) const {
+  Resource stamp = InterfaceStamp();
+  string prerequisites, order_only;
+  SplitOrderOnly(input_files, &prerequisites, &order_only);
+  Makefile::Rule* rule = out->StartRule(stamp.path(), prerequisites,
+                                        order_only);
+  rule->WriteCommand("mkdir -p " + stamp.dirname());
+  rule->WriteCommand("touch " + stamp.path());
+  out->FinishRule(rule);
+}
+
 void CCLibraryNode::WriteCompile(const Resource& source,
                                  const ResourceFileSet& input_files,
                                  Makefile* out) const {
-  Resource obj = ObjForSource(source);
-  bool ephemeral_output = source.has_tag("ephemeral");
-  string ephemeral_dot_o;
-
-  if (ephemeral_output) {
-    // When a user runs a parallel make ("make -j8"), two cc_binaries
-    // that depend on the same cc_library containing ephemeral sources
-    // may each call make recursively to compile the same source file.
-    // To avoid corruption by simultaneous compilation to the same .o
-    // file, we use distinct temporary file names, then "mv" the .o
-    // file to the correct place atomically.  It remains a race as to
-    // which instance of the .o gets used: it could be either or both.
-    ephemeral_dot_o = "ephemeral" + obj.path();
-    out->append("\n" + ephemeral_dot_o +
-		" := $(shell mkdir -p " + obj.dirname() + "; "
-		"mktemp --tmpdir=" + obj.dirname() + ")\n");
-    ephemeral_dot_o = "$(" + ephemeral_dot_o + ")";
+  bool cpp = IsCppSource(source);
+  string compile = DefaultCompileFlags(cpp);
+  if (source.has_tag("ephemeral")) {
+    // Every binary linking us compiles this source into its own object (see
+    // WriteEphemeralCompiles), with this command. Without a depfile, a
+    // change to any header in our interface counts as a change.
+    Resource inputs = OutputForSource(source);
+    out->append(strings::Join(
+        "\n", EphemeralCompileVariable(inputs), " := ",
+        strings::JoinWith(" ",
+                          compile,
+                          CompileFlagsVariable(cpp ? CPP : C_LANG),
+                          source.path()),
+        "\n"));
+    Makefile::Rule* rule = out->StartRule(
+        inputs.path(),
+        strings::JoinWith(" ", source.path(),
+                          strings::JoinAll(input_files.files(), " ")));
+    rule->WriteCommand("mkdir -p " + inputs.dirname());
+    rule->WriteCommand("touch " + inputs.path());
+    out->FinishRule(rule);
+    return;
   }
 
-  // Rule=> obj: <input header files> source.cc
+  Resource obj = ObjForSource(source);
+  // Rule=> obj: source.cc | <interface stamp>
+  // The compiler's depfile lists the headers we actually include, so the
+  // transitive headers (and generating rules) only need to exist first.
+  string depfile = obj.path().substr(0, obj.path().size() - 2) + ".d";
   Makefile::Rule* rule =
       out->StartRule(obj.path(),
-                     strings::JoinWith(
-                         " ",
-                         strings::JoinAll(input_files.files(), " "),
-                         source.path()));
-  
+                     source.path(),
+                     strings::JoinAll(input_files.files(), " "));
+
   // Mkdir command.
   rule->WriteCommand("mkdir -p " + obj.dirname());
 
-  // Compile command (.e.g $(COMPILE.c) or $(COMPILE.cc)).
-  bool cpp = (strings::HasSuffix(source.basename(), ".cc") ||
-              strings::HasSuffix(source.basename(), ".cpp"));
-  string compile = DefaultCompileFlags(cpp);
+  // Actual make command.
+  rule->WriteUserEcho("Compiling",
+                      source.path() + " (" + (cpp ? "c++" : "c") + ")");
+  rule->WriteCommand(strings::JoinWith(
+      " ",
+      compile,
+      CompileFlagsVariable(cpp ? CPP : C_LANG),
+      "-MMD -MP -MF " + depfile + " -MT " + obj.path(),
+      source.path(),
+      "-o " + obj.path()));
+  rule->SetDepfile(depfile);
+  rule->SetCacheable();
+  SetResourceClass("cpu", rule);
+  out->FinishRule(rule);
+}
+
+// static
+string CCLibraryNode::EphemeralCompileVariable(const Resource& inputs) {
+  return "ephemeral_compile." + inputs.path();
+}
 
+void CCLibraryNode::WriteEphemeralCompiles(const Resource& file,
+                                           ResourceFileSet* objects,
+                                           Makefile* out) const {
+  ResourceFileSet ephemeral, normal;
+  for (const Resource& r : *objects) {
+    (r.has_tag("ephemeral") ? &ephemeral : &normal)->Add(r);
+  }
+  if (ephemeral.files().empty()) {
+    return;
+  }
+
+  // Each copy is recompiled whenever one of the other objects changes, so
+  // whenever 'file' is relinked. It is written to a temporary and renamed
+  // into place.
+  map<string, Resource> copies;
+  for (const Resource& inputs : ephemeral) {
+    string obj = inputs.path().substr(
+        0, inputs.path().size() - strlen(kEphemeralInputs));
+    Resource copy = Resource::FromLocalPath(file.path() + ".ephemeral",
+                                            StripSpecialDirs(obj));
+    copy.CopyTags(inputs);
+    copies[inputs.path()] = copy;
+    Makefile::Rule* rule = out->StartRule(
+        copy.path(),
+        strings::JoinWith(" ", strings::JoinAll(normal.files(), " "),
+                          inputs.path()));
+    rule->WriteUserEcho("Compiling", copy.path() + " (ephemeral)");
+    rule->WriteCommand("mkdir -p " + copy.dirname());
+    rule->WriteCommand("$(" + EphemeralCompileVariable(inputs) + ") -o " +
+                       copy.path() + ".tmp && mv -f " + copy.path() +
+                       ".tmp " + copy.path());
+    SetResourceClass("cpu", rule);
+    out->FinishRule(rule);
+  }
+
+  ResourceFileSet replaced;
+  for (const Resource& r : *objects) {
+    auto it = copies.find(r.path());
+    replaced.Add(it == copies.end() ? r : it->second);
+  }
+  *objects = replaced;
+}
+
+string CCLibraryNode::CompileFlagsVariable(LanguageType lang) const {
+  return strings::Join("$(", (lang == CPP ? kCxxFlags : kCFlags), ".",
+                       target().make_path(), ")");
+}
+
+void CCLibraryNode::WriteCompileFlags(LanguageType lang, Makefile* out) const {
   // Include directories.
   string include_dirs;
   {
     set<string> include_dir_set, final_includes;
-    IncludeDirs(cpp ? CPP : C_LANG, &include_dir_set);
+    IncludeDirs(lang, &include_dir_set);
     for (const string& str: include_dir_set) {
       final_includes.insert(str);
       string path = NodeUtil::StripSpecialDirs(input(), str);
@@ -251,50 +370,28 @@ void CCLibraryNode::WriteCompile(const Resource& source,
   string output_compile_args;
   {
     set<string> header_compile_args;
-    CompileFlags(cpp ? CPP : C_LANG, &header_compile_args);
+    CompileFlags(lang, &header_compile_args);
     output_compile_args = strings::JoinWith(
         " ",
         strings::JoinAll(header_compile_args, " "),
-        GetVariable(cpp ? kCxxCompileArgs : kCCompileArgs).ref_name());
+        GetVariable(lang == CPP ? kCxxCompileArgs : kCCompileArgs).ref_name());
   }
 
-  // Actual make command.
-  rule->WriteUserEcho("Compiling",
-                      source.path() + " (" + (cpp ? "c++" : "c") + ")");
-  rule->WriteCommand(strings::JoinWith(
-      " ",
-      compile,
-      include_dirs,
-      output_compile_args,
-      source.path(),
-      "-o " + (ephemeral_output ? ephemeral_dot_o : obj.path())));
-
-  if (ephemeral_output) {
-    rule->WriteCommand("mv " + ephemeral_dot_o + " " + obj.path());
-  }
-
-  out->FinishRule(rule);
-
-  if (ephemeral_output) {
-    // Tell make to ignore any existing object file; i.e., force recompile.
-    out->append("\n.PHONY: ");
-    out->append(obj.path());
-    out->append("\n\n");
-  }
+  out->append(strings::Join(
+      "\n", (lang == CPP ? kCxxFlags : kCFlags), ".", target().make_path(),
+      " := ", strings::JoinWith(" ", include_dirs, output_compile_args),
+      "\n"));
 }
 
 void CCLibraryNode::LocalDependencyFiles(LanguageType lang,
                                          ResourceFileSet* files) const {
-  if (HasVariable(kHeaderVariable)) {
-    files->Add(Resource::FromRaw(
-        GetVariable(kHeaderVariable).ref_name()));
-  }
+  files->Add(InterfaceStamp());
 }
 
 void CCLibraryNode::LocalObjectFiles(LanguageType lang,
                                      ResourceFileSet* files) const {
   for (const Resource& src : sources_) {
-    files->Add(ObjForSource(src));
+    files->Add(OutputForSource(src));
   }
   for (const Resource& obj : objects_) {
     files->Add(obj);
@@ -404,12 +501,18 @@ string WriteCxxflag(const Input& input, bool gcc, bool basic) {
 
 // static
 void CCLibraryNode::WriteMakeHead(const Input& input, Makefile* out) {
-  // Some conditional variables
+  // Some conditional variables. Probing the toolchain forks the compilers,
+  // so the results are cached in a makefile per $(CXX)/$(CC) pair. That
+  // makefile depends on the compiler binaries it found, so make reprobes
+  // (and restarts) only when a compiler changes.
+  string config = "$(" + string(kToolchainConfig) + ")";
   out->append("# Some compiler specific flag settings.\n");
-  out->append(string(kCxxGcc) + " := $(shell echo $$($(CXX) --version | "
-              "egrep '(gcc|g\\+\\+)' | head -n 1 | wc -l))\n");
-  out->append(string(kCGcc) + " := $(shell echo $$($(CC) --version | "
-              "egrep '(gcc|g\\+\\+|^cc)' | head -n 1 | wc -l))\n");
+  out->append("toolchain_empty :=\n"
+              "toolchain_space := $(toolchain_empty) $(toolchain_empty)\n");
+  out->append(string(kToolchainConfig) + " := " +
+              strings::JoinPath(input.genfile_dir(), "toolchain") +
+              "/$(subst /,_,$(subst $(toolchain_space),_,$(CXX)__$(CC))).mk\n");
+  out->append("-include " + config + "\n");
 
   // Write the global values
   // CFLAGS:
@@ -434,7 +537,23 @@ void CCLibraryNode::WriteMakeHead(const Input& input, Makefile* out) {
   out->append("\t" + WriteLdflag(input, false));
   out->append("\t" + WriteCxxflag(input, false, false));
   out->append("\t" + WriteCxxflag(input, false, true));
-  out->append("endif\n\n");
+  out->append("endif\n");
+
+  // After the conditionals: their tab-indented assignments would otherwise
+  // be read as this rule's recipe.
+  Makefile::Rule* rule = out->StartRawRule(config, "");
+  rule->WriteCommand("mkdir -p $(dir $@)");
+  rule->WriteCommand(
+      "(echo \"" + string(kCxxGcc) + " := $$(echo $$($(CXX) --version | "
+      "egrep '(gcc|g\\+\\+)' | head -n 1 | wc -l))\"; "
+      "echo \"" + string(kCGcc) + " := $$(echo $$($(CC) --version | "
+      "egrep '(gcc|g\\+\\+|^cc)' | head -n 1 | wc -l))\"; "
+      "echo \"" + string(kIsDarwin) + " := $$(echo $$("
+      "uname | grep 'Darwin' | wc -l))\"; "
+      "echo \"$@: $$(command -v $(firstword $(CXX))) "
+      "$$(command -v $(firstword $(CC)))\") > $@.tmp && mv $@.tmp $@");
+  out->FinishRule(rule);
+  out->append("\n");
 }
 
 Resource CCLibraryNode::ObjForSource(const Resource& source) const {
@@ -444,6 +563,17 @@ Resource CCLibraryNode::ObjForSource(const Resource& source) const {
   return r;
 }
 
+Resource CCLibraryNode::OutputForSource(const Resource& source) const {
+  Resource obj = ObjForSource(source);
+  if (!source.has_tag("ephemeral")) {
+    return obj;
+  }
+  Resource inputs = Resource::FromLocalPath(obj.dirname(),
+                                            obj.basename() + kEphemeralInputs);
+  inputs.CopyTags(source);
+  return inputs;
+}
+
 void CCLibraryNode::AddVariable(const string& cpp_name,
                                 const string& c_name,
                                 const string& gcc_value,
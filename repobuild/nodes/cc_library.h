@@ -47,13 +47,46 @@ class CCLibraryNode : public Node {
   static void WriteMakeHead(const Input& input, Makefile* out);
 
  protected:
+  // Dependents see our interface stamp (see InterfaceStamp), which covers
+  // everything below us.
+  virtual bool IncludeDependencies(DependencyCollectionType type,
+                                   LanguageType lang) const {
+    return type != DEPENDENCY_FILES;
+  }
+
   void Init();
   std::string DefaultCompileFlags(bool cpp_mode) const;
+
+  // Touched once our headers, and the interfaces of our direct dependencies,
+  // are ready. Compiles (ours and our dependents') wait on this alone rather
+  // than on every header in the closure.
+  Resource InterfaceStamp() const { return Touchfile(".interface"); }
+  void WriteInterfaceStamp(const ResourceFileSet& input_files,
+                           Makefile* out) const;
+
+  // Make variable holding the include dirs and flags for every 'lang'
+  // source in this library, written once by WriteCompileFlags.
+  std::string CompileFlagsVariable(LanguageType lang) const;
+  void WriteCompileFlags(LanguageType lang, Makefile* out) const;
+
+  // Ephemeral sources are compiled by each binary that links them, into
+  // an object of its own. Our object file for one is a stamp, 'inputs',
+  // touched once the source and its headers are ready. This make variable
+  // holds the command (minus "-o") that compiles it.
+  static std::string EphemeralCompileVariable(const Resource& inputs);
+
+  // Writes a rule per ephemeral stamp in 'objects' compiling it into an
+  // object private to 'file', and replaces the stamp with that object.
+  void WriteEphemeralCompiles(const Resource& file,
+                              ResourceFileSet* objects,
+                              Makefile* out) const;
   void WriteCompile(const Resource& source,
                     const ResourceFileSet& input_files,
                     Makefile* out) const;
   void LocalWriteMakeInternal(bool should_write_target, Makefile* out) const;
   Resource ObjForSource(const Resource& source) const;
+  // ObjForSource, or the stamp of an ephemeral source.
+  Resource OutputForSource(const Resource& source) const;
   void AddVariable(const std::string& cpp_name,
                    const std::string& c_name,
                    const std::string& gcc_value,
@@ -109,14 +109,15 @@ void CCSharedLibraryNode::LocalWriteMake(Makefile* out) const {
 }
 
 void CCSharedLibraryNode::WriteLink(Makefile* out) const {
+  Resource file = OutLinkedObj();
   ResourceFileSet objects;
   CCLibraryNode::ObjectFiles(CPP, &objects);
+  WriteEphemeralCompiles(file, &objects, out);
 
   set<string> flags;
   LinkFlags(CPP, &flags);
 
   // Link rule
-  Resource file = OutLinkedObj();
   Makefile::Rule* rule = out->StartRule(file.path(),
                                         strings::JoinAll(objects.files(), " "));
   rule->WriteUserEcho("Linking", file.path());
@@ -146,6 +147,7 @@ void CCSharedLibraryNode::WriteLink(Makefile* out) const {
                      "\"" + file.path() + "\" ] || "
                      "ln -n -f -s " + GetVariable("basename").ref_name() + " " +
                      file.path());
+  SetResourceClass("link", rule);
   out->FinishRule(rule);
 }
 
@@ -202,11 +204,9 @@ void CCSharedLibraryNode::WriteMakeHead(const Input& input, Makefile* out) {
   // SHARED_LIB_ARGS;
   out->append("# Some platform specific flag settings.\n");
 
-  out->append(string(kIsDarwin) + " := $(shell echo $$("
-              "uname | grep 'Darwin' | wc -l))\n");
-  out->append(string(kIsDarwinAndClang) + " := $(shell echo $$((("
-              "$(" + string(kIsDarwin) + ") == 1 && "
-              "$(" + string(kCxxGcc) + ") == 0))))\n");
+  // IS_DARWIN comes from the cached toolchain probe (see cc_library.cc).
+  out->append(string(kIsDarwinAndClang) + " := $(if $(filter 10,"
+              "$(" + string(kIsDarwin) + ")$(" + string(kCxxGcc) + ")),1,0)\n");
 
   out->append("ifeq ($(" + string(kIsDarwinAndClang) + "),1)\n");
 
@@ -60,8 +60,10 @@ void CmakeNode::Parse(BuildFile* file, const BuildFileNode& input) {
       "STAGING=$DEST_DIR/.staging; "
       "cd $GEN_DIR/build";
   string build_env = user_env +"CC=$CC CXX=$CXX ";
+  // NB: Our make subnode builds the result with $MAKE, as part of our
+  // jobserver, whatever CMAKE_GENERATOR says.
   string cmake_cmd =
-      "cmake -DCMAKE_INSTALL_PREFIX=. -B . $BASE "
+      "cmake -G \"Unix Makefiles\" -DCMAKE_INSTALL_PREFIX=. -B . $BASE "
       "-DCMAKE_CXX_FLAGS=\"$BASIC_CXXFLAGS $USER_CXXFLAGS\" "
       "-DCMAKE_C_FLAGS=\"$BASIC_CFLAGS $USER_CFLAGS\"";
   for (const string& it : cmake_args) {
@@ -76,6 +76,11 @@ void ConfigNode::Parse(BuildFile* file, const BuildFileNode& input) {
   pkgfile_dummy_file_ =
       Resource::FromRootPath(DummyFile(SourceDir(Node::input().pkgfile_dir())));
 
+  // These only say that our symlinks exist (see AddSymlink).
+  source_dummy_file_.add_tag("order_only");
+  gendir_dummy_file_.add_tag("order_only");
+  pkgfile_dummy_file_.add_tag("order_only");
+
   if (component_.get() != NULL) {
     file->AddDependencyRewriter(new ConfigRewriter(component_->Clone()));
   }
@@ -139,10 +144,10 @@ void ConfigNode::AddSymlink(const string& dir,
   out->FinishRule(rule);
 
   // Dummy file (to avoid directory timestamp causing everything to rebuild).
-  // .gen-src/repobuild/.dummy: .gen-src/repobuild
+  // .gen-src/repobuild/.dummy: | .gen-src/repobuild
   //   [ -f .gen-src/repobuild/.dummy ] || touch .gen-src/repobuild/.dummy
   string dummy = DummyFile(dir);
-  rule = out->StartRule(dummy, dir);
+  rule = out->StartRule(dummy, "", dir);
   rule->WriteCommand(strings::Join("[ -f ", dummy, " ] || touch ", dummy));
   out->FinishRule(rule);
 }
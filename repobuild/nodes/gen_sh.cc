@@ -27,6 +27,21 @@ using std::set;
 namespace repobuild {
 namespace {
 const char kRootDir[] = "ROOT_DIR";
+const char kMake[] = "repobuild_make";
+
+// Our script rewrites every output, so we keep a copy of each and put back
+// the ones with unchanged contents (and their old mtimes). Rules depending
+// on those are not rerun.
+string SaveOutputs(const vector<Resource>& outputs) {
+  return "for f in " + strings::JoinAll(outputs, " ") + "; do "
+      "[ ! -f $$f ] || cp -p $$f $$f.prev; done";
+}
+
+string RestoreUnchangedOutputs(const vector<Resource>& outputs) {
+  return "for f in " + strings::JoinAll(outputs, " ") + "; do "
+      "if cmp -s $$f $$f.prev; then mv -f $$f.prev $$f; "
+      "else rm -f $$f.prev; fi; done";
+}
 }
 
 void GenShNode::Parse(BuildFile* file, const BuildFileNode& input) {
@@ -53,7 +68,8 @@ void GenShNode::Set(const string& build_cmd,
 // static
 void GenShNode::WriteMakeHead(const Input& input, Makefile* out) {
   out->append("# Environment flag settings.\n");
-  out->append(string(kRootDir) + " := $(shell pwd)\n");
+  out->append(string(kRootDir) + " := $(CURDIR)\n");
+  out->append(string(kMake) + " = $(MAKE)\n");
 }
 
 void GenShNode::LocalWriteMake(Makefile* out) const {
@@ -67,20 +83,28 @@ void GenShNode::LocalWriteMake(Makefile* out) const {
   ObjectFiles(NO_LANG, &obj_files);
 
   // Make target
-  Makefile::Rule* rule = out->StartRule(touchfile.path(), strings::JoinWith(
-      " ",
-      strings::JoinAll(input_files.files(), " "),
-      strings::JoinAll(obj_files.files(), " "),
-      strings::JoinAll(input_files_, " ")));
+  string prerequisites, order_only;
+  SplitOrderOnly(input_files, &prerequisites, &order_only);
+  Makefile::Rule* rule = out->StartRule(
+      touchfile.path(),
+      strings::JoinWith(" ",
+                        prerequisites,
+                        strings::JoinAll(obj_files.files(), " "),
+                        strings::JoinAll(input_files_, " ")),
+      order_only);
 
   // Build command.
-  if (!build_cmd_.empty()) {
+  if (!build_cmd_.empty() || !recursive_cmd_.empty()) {
     rule->WriteUserEcho(make_name_, make_target_);
 
     // The file we touch after the script runs, for 'make' to be happy.
     string touch_cmd = "mkdir -p " +
         strings::JoinPath(input().object_dir(), target().dir()) +
         "; touch " + touchfile.path();
+    if (!outputs_.empty()) {
+      rule->WriteCommand(SaveOutputs(outputs_));
+      touch_cmd = RestoreUnchangedOutputs(outputs_) + "; " + touch_cmd;
+    }
 
     // Compute the build command prefix.
     string prefix;
@@ -102,10 +126,23 @@ void GenShNode::LocalWriteMake(Makefile* out) const {
 
     // Now write the actual comment.
     // This is a hack for now.
-    string command = strings::ReplaceAll(
-        build_cmd_, "$(ROOT_DIR)", "$ROOT_DIR");
-    rule->WriteCommand(WriteCommand(env_vars, prefix, command, touch_cmd));
+    if (!recursive_cmd_.empty()) {
+      string command = strings::ReplaceAll(
+          recursive_cmd_, "$(ROOT_DIR)", "$ROOT_DIR");
+      rule->WriteRecursiveCommand(WriteCommand(env_vars, prefix, command, ""));
+    }
+    if (!build_cmd_.empty()) {
+      string command = strings::ReplaceAll(
+          build_cmd_, "$(ROOT_DIR)", "$ROOT_DIR");
+      rule->WriteCommand(WriteCommand(env_vars, prefix, command, touch_cmd));
+    } else {
+      rule->WriteCommand(touch_cmd);
+    }
+  }
+  for (const Resource& resource : outputs_) {
+    rule->AddOutput(resource.path());
   }
+  rule->SetRestat();
   out->FinishRule(rule);
 
   {  // user target
@@ -113,10 +150,6 @@ void GenShNode::LocalWriteMake(Makefile* out) const {
     output_targets.Add(touchfile);
     WriteBaseUserTarget(output_targets, out);
   }
-
-  for (const Resource& resource : outputs_) {
-    out->WriteRule(resource.path(), touchfile.path());
-  }
 }
 
 void GenShNode::LocalWriteMakeClean(Makefile::Rule* rule) const {
@@ -168,7 +201,9 @@ string GenShNode::WriteCommand(const map<string, string>& env_vars,
   AddEnvVar("CFLAGS", &out);
   AddEnvVar("BASIC_CFLAGS", &out);
   AddEnvVar("LDFLAGS", &out);
-  AddEnvVar("MAKE", &out);
+  // Not $(MAKE) itself: make would take any script for a sub-make, run it
+  // under "make -n" and hand it the jobserver (see SetRecursiveCmd).
+  out.append(" MAKE=\"$(" + string(kMake) + ")\"");
   for (const auto& it : env_vars) {
     out.append(" ");
     out.append(it.first);
@@ -210,7 +245,13 @@ string GenShNode::WriteCommand(const map<string, string>& env_vars,
 
 void GenShNode::LocalDependencyFiles(LanguageType lang,
                                      ResourceFileSet* files) const {
-  files->Add(Touchfile());
+  if (outputs_.empty()) {
+    files->Add(Touchfile());
+    return;
+  }
+  for (const Resource& resource : outputs_) {
+    files->Add(resource);
+  }
 }
 
 }  // namespace repobuild
@@ -39,6 +39,9 @@ class GenShNode : public Node {
     local_env_vars_[var] = val;
   }
   void SetMakefileEscape(bool escape) { escape_command_ = escape; }
+  // 'cmd' runs $MAKE, on a recipe line of its own before build_cmd. Only
+  // that line shares the jobserver of our make, and runs under "make -n".
+  void SetRecursiveCmd(const std::string& cmd) { recursive_cmd_ = cmd; }
 
   // Static preprocessors
   static void WriteMakeHead(const Input& input, Makefile* out);
@@ -56,8 +59,9 @@ class GenShNode : public Node {
   virtual void LocalDependencyFiles(LanguageType lang,
                                     ResourceFileSet* files) const;
 
-  // NB: We intentionally do not pass on files, and rely soley
-  // on our "touchfile'.
+  // NB: We intentionally do not pass on files, and rely soley on our
+  // outputs (or our "touchfile" if we have none). Outputs whose contents
+  // did not change keep their mtime, so dependents are not rebuilt.
   virtual bool IncludeDependencies(DependencyCollectionType type,
                                    LanguageType lang) const {
     return (type == BINARIES ||
@@ -72,6 +76,7 @@ class GenShNode : public Node {
   bool cd_;
   std::string make_name_, make_target_;
   bool escape_command_;
+  std::string recursive_cmd_;
 };
 
 }  // namespace repobuild
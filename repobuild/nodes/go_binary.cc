@@ -50,8 +50,9 @@ void GoBinaryNode::WriteGoBinary(const Resource& bin, Makefile* out) const {
   LocalObjectFiles(GO_LANG, &inputs);
 
   // Output binary
-  Makefile::Rule* rule = out->StartRule(bin.path(),
-                                        strings::JoinAll(deps.files(), " "));
+  string prerequisites, order_only;
+  SplitOrderOnly(deps, &prerequisites, &order_only);
+  Makefile::Rule* rule = out->StartRule(bin.path(), prerequisites, order_only);
   rule->WriteUserEcho("Go build", bin.path());
   rule->WriteCommand("mkdir -p " + bin.dirname());
   rule->WriteCommand(
@@ -61,6 +62,7 @@ void GoBinaryNode::WriteGoBinary(const Resource& bin, Makefile* out) const {
           strings::JoinAll(input().flags("-G"), " "),
           strings::JoinAll(go_build_args_, " "),
           strings::JoinAll(inputs.files(), " ")));
+  SetResourceClass("link", rule);
   out->FinishRule(rule);
 }
 
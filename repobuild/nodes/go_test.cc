@@ -51,8 +51,10 @@ void GoTestNode::WriteGoTest(Makefile* out) const {
 
   // Output test
   Resource touchfile = Touchfile("test");
-  Makefile::Rule* rule = out->StartRule(touchfile.path(),
-                                        strings::JoinAll(deps.files(), " "));
+  string prerequisites, order_only;
+  SplitOrderOnly(deps, &prerequisites, &order_only);
+  Makefile::Rule* rule = out->StartRule(touchfile.path(), prerequisites,
+                                        order_only);
   rule->WriteUserEcho("Testing", target().make_path());
   rule->WriteCommand(
       strings::JoinWith(
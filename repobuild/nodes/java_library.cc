@@ -10,6 +10,7 @@
 #include "common/strings/strutil.h"
 #include "repobuild/env/input.h"
 #include "repobuild/nodes/java_library.h"
+#include "repobuild/nodes/makefile.h"
 #include "repobuild/nodes/util.h"
 #include "repobuild/reader/buildfile.h"
 
@@ -18,6 +19,247 @@ using std::string;
 using std::set;
 
 namespace repobuild {
+namespace {
+const char kJavacCommand[] = "repobuild_javac";
+
+// javac_client.pl <dir> <idle seconds> <java> <javac> <javac args...>
+// Compiles in the JavacServer of <dir>, starting it as needed, and falls
+// back to running <javac> itself.
+const char kJavacClientScript[] =
+    "#!/usr/bin/perl\n"
+    "# Runs javac in the JavacServer of <dir>, starting one if there is none,\n"
+    "# or by itself if that does not work out.\n"
+    "use warnings;\n"
+    "use strict;\n"
+    "use Cwd qw(getcwd);\n"
+    "use Fcntl qw(:flock);\n"
+    "use File::Path qw(make_path);\n"
+    "use IO::Socket::INET;\n"
+    "use POSIX qw(:sys_wait_h setsid);\n"
+    "\n"
+    "my $dir = shift;\n"
+    "my $idle = shift;\n"
+    "my @java = split(' ', shift || '');\n"
+    "my @javac = split(' ', shift || '');\n"
+    "if (!$dir || !defined($idle) || $idle !~ /^\\d+$/ ||\n"
+    "    !@java || !@javac) {\n"
+    "    die(\"usage: $0 <dir> <idle seconds> <java> <javac> <args...>\\n\");\n"
+    "}\n"
+    "my $port_file = \"$dir/port\";\n"
+    "\n"
+    "sub OneShot {\n"
+    "    exec { $javac[0] } @javac, @ARGV;\n"
+    "    die(\"$javac[0]: $!\\n\");\n"
+    "}\n"
+    "\n"
+    "# Returns the exit status and output, or nothing without an answer.\n"
+    "sub Compile {\n"
+    "    local $SIG{PIPE} = 'IGNORE';\n"
+    "    open(my $fh, '<', $port_file) || return;\n"
+    "    my ($port, $token) = split(' ', <$fh> // '');\n"
+    "    close($fh);\n"
+    "    return if (!$token);\n"
+    "    my $socket = IO::Socket::INET->new(PeerAddr => '127.0.0.1',\n"
+    "                                       PeerPort => $port,\n"
+    "                                       Timeout => 5) || return;\n"
+    "    print $socket join(\"\\n\", $token, getcwd(), scalar(@ARGV), @ARGV);\n"
+    "    print $socket \"\\n\";\n"
+    "    my $header = <$socket>;\n"
+    "    return if (!defined($header) || $header !~ /^(\\d+) (\\d+)\\n$/);\n"
+    "    my ($status, $size, $output) = ($1, $2, '');\n"
+    "    while (length($output) < $size) {\n"
+    "        read($socket, $output, $size - length($output), length($output))\n"
+    "            || return;\n"
+    "    }\n"
+    "    return ($status, $output);\n"
+    "}\n"
+    "\n"
+    "sub StartServer {\n"
+    "    my $class = \"$dir/JavacServer.class\";\n"
+    "    my $source = \"$dir/JavacServer.java\";\n"
+    "    if (!-f $class || -M $class > -M $source) {\n"
+    "        system { $javac[0] } @javac, '-d', $dir, $source;\n"
+    "        return 0 if ($? != 0);\n"
+    "    }\n"
+    "    unlink($port_file);\n"
+    "    my $pid = fork();\n"
+    "    return 0 if (!defined($pid));\n"
+    "    if ($pid == 0) {\n"
+    "        # Out of make's way: its own session, and none of make's files.\n"
+    "        setsid();\n"
+    "        umask(077);  # the port file has the token.\n"
+    "        open(STDIN, '<', '/dev/null');\n"
+    "        open(STDOUT, '>>', \"$dir/server.log\");\n"
+    "        open(STDERR, '>&', \\*STDOUT);\n"
+    "        POSIX::close($_) for (3 .. 255);\n"
+    "        exec { $java[0] } @java, '-cp', $dir, 'JavacServer', $port_file,\n"
+    "                          $idle or POSIX::_exit(127);\n"
+    "    }\n"
+    "    for (1 .. 300) {\n"
+    "        return 1 if (-s $port_file);\n"
+    "        return 0 if (waitpid($pid, WNOHANG) == $pid);\n"
+    "        select(undef, undef, undef, 0.1);\n"
+    "    }\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "# JVM options and argument files only work for a javac of its own.\n"
+    "OneShot() if (grep { /\\n/ || /^(-J|@)/ } @ARGV);\n"
+    "my @result = Compile();\n"
+    "if (!@result) {\n"
+    "    make_path($dir);\n"
+    "    open(my $lock, '>>', \"$dir/lock\") || OneShot();\n"
+    "    flock($lock, LOCK_EX) || OneShot();\n"
+    "    @result = Compile();  # another one started it meanwhile.\n"
+    "    @result = Compile() if (!@result && StartServer());\n"
+    "    close($lock);\n"
+    "}\n"
+    "OneShot() if (!@result);\n"
+    "print STDERR $result[1];\n"
+    "exit($result[0]);\n";
+
+// The javac that stays up between compiles, for the client above.
+const char kJavacServerSource[] =
+    "// Compiles for javac_client.pl, so javac starts (and warms up) once.\n"
+    "// One request per connection, a line each:\n"
+    "//   <token> <working directory> <argument count> <arguments...>\n"
+    "// answered with \"<exit status> <size>\" and what javac printed.\n"
+    "// Anything else closes the connection, and the client runs javac\n"
+    "// itself. It leaves after a while idle, or when another server takes\n"
+    "// its port file.\n"
+    "import java.io.*;\n"
+    "import java.net.*;\n"
+    "import java.security.SecureRandom;\n"
+    "import java.util.concurrent.*;\n"
+    "import java.util.concurrent.atomic.AtomicInteger;\n"
+    "import javax.tools.*;\n"
+    "\n"
+    "public class JavacServer {\n"
+    "  private static final AtomicInteger active = new AtomicInteger();\n"
+    "  private static volatile long lastUsed = System.currentTimeMillis();\n"
+    "\n"
+    "  public static void main(String[] args) throws Exception {\n"
+    "    File portFile = new File(args[0]);\n"
+    "    long idleMillis = Long.parseLong(args[1]) * 1000L;\n"
+    "    final JavaCompiler compiler = ToolProvider.getSystemJavaCompiler();\n"
+    "    if (compiler == null) {\n"
+    "      System.err.println(\"No system java compiler, is this a JRE?\");\n"
+    "      System.exit(1);\n"
+    "    }\n"
+    "    final String root = new File(\".\").getCanonicalPath();\n"
+    "    ServerSocket server =\n"
+    "        new ServerSocket(0, 64, InetAddress.getByName(\"127.0.0.1\"));\n"
+    "    server.setSoTimeout(1000);\n"
+    "    SecureRandom random = new SecureRandom();\n"
+    "    final String token = Long.toHexString(random.nextLong()) +\n"
+    "        Long.toHexString(random.nextLong());\n"
+    "    String contents = server.getLocalPort() + \" \" + token + \"\\n\";\n"
+    "    File tmp = new File(args[0] + \".tmp\");\n"
+    "    OutputStream out = new FileOutputStream(tmp);\n"
+    "    out.write(contents.getBytes(\"UTF-8\"));\n"
+    "    out.close();\n"
+    "    if (!tmp.renameTo(portFile)) {\n"
+    "      System.err.println(\"Could not write \" + portFile);\n"
+    "      System.exit(1);\n"
+    "    }\n"
+    "\n"
+    "    ExecutorService threads = Executors.newCachedThreadPool();\n"
+    "    while (true) {\n"
+    "      final Socket socket;\n"
+    "      try {\n"
+    "        socket = server.accept();\n"
+    "      } catch (SocketTimeoutException e) {\n"
+    "        if (!contents.equals(read(portFile))) {\n"
+    "          break;\n"
+    "        }\n"
+    "        if (active.get() == 0 &&\n"
+    "            System.currentTimeMillis() - lastUsed > idleMillis) {\n"
+    "          portFile.delete();\n"
+    "          break;\n"
+    "        }\n"
+    "        continue;\n"
+    "      }\n"
+    "      active.incrementAndGet();\n"
+    "      threads.execute(new Runnable() {\n"
+    "        public void run() {\n"
+    "          try {\n"
+    "            serve(socket, compiler, root, token);\n"
+    "          } finally {\n"
+    "            lastUsed = System.currentTimeMillis();\n"
+    "            active.decrementAndGet();\n"
+    "          }\n"
+    "        }\n"
+    "      });\n"
+    "    }\n"
+    "    server.close();\n"
+    "    threads.shutdown();  // finish the compiles we have.\n"
+    "    threads.awaitTermination(1, TimeUnit.HOURS);\n"
+    "    System.exit(0);\n"
+    "  }\n"
+    "\n"
+    "  private static String read(File file) {\n"
+    "    try {\n"
+    "      BufferedReader in = new BufferedReader(new FileReader(file));\n"
+    "      try {\n"
+    "        return in.readLine() + \"\\n\";\n"
+    "      } finally {\n"
+    "        in.close();\n"
+    "      }\n"
+    "    } catch (IOException e) {\n"
+    "      return \"\";\n"
+    "    }\n"
+    "  }\n"
+    "\n"
+    "  private static void serve(Socket socket, JavaCompiler compiler,\n"
+    "                            String root, String token) {\n"
+    "    try {\n"
+    "      socket.setSoTimeout(60000);\n"
+    "      BufferedReader in = new BufferedReader(\n"
+    "          new InputStreamReader(socket.getInputStream(), \"UTF-8\"));\n"
+    "      if (!token.equals(in.readLine())) {\n"
+    "        return;\n"
+    "      }\n"
+    "      String dir = in.readLine();\n"
+    "      if (dir == null ||\n"
+    "          !new File(dir).getCanonicalPath().equals(root)) {\n"
+    "        return;  // not ours to run.\n"
+    "      }\n"
+    "      String[] args = new String[Integer.parseInt(in.readLine())];\n"
+    "      for (int i = 0; i < args.length; ++i) {\n"
+    "        if ((args[i] = in.readLine()) == null) {\n"
+    "          return;\n"
+    "        }\n"
+    "      }\n"
+    "      ByteArrayOutputStream output = new ByteArrayOutputStream();\n"
+    "      int status = compiler.run(null, output, output, args);\n"
+    "      OutputStream out = socket.getOutputStream();\n"
+    "      String header = status + \" \" + output.size() + \"\\n\";\n"
+    "      out.write(header.getBytes(\"UTF-8\"));\n"
+    "      output.writeTo(out);\n"
+    "      out.flush();\n"
+    "    } catch (Throwable e) {\n"
+    "      // The client runs javac itself, which reports it.\n"
+    "    } finally {\n"
+    "      try {\n"
+    "        socket.close();\n"
+    "      } catch (IOException e) {\n"
+    "      }\n"
+    "    }\n"
+    "  }\n"
+    "}\n";
+
+string JavacServerDir(const Input& input) {
+  return strings::JoinPath(input.genfile_dir(), "javac_server");
+}
+
+string JavacClientScript(const Input& input) {
+  return strings::JoinPath(JavacServerDir(input), "javac_client.pl");
+}
+
+string JavacServerSource(const Input& input) {
+  return strings::JoinPath(JavacServerDir(input), "JavacServer.java");
+}
+}  // anonymous namespace
 
 JavaLibraryNode::JavaLibraryNode(const TargetInfo& t,
                                  const Input& i,
@@ -118,19 +360,24 @@ void JavaLibraryNode::WriteCompile(const ResourceFileSet& input_files,
   // NB: Make has a bug with multiple output files and parallel execution.
   // Thus, we use a touchfile and generate a separate rule for each output file.
   Resource touchfile = Touchfile("compile");
+  string prerequisites, order_only;
+  SplitOrderOnly(input_files, &prerequisites, &order_only);
+  order_only = strings::JoinWith(" ",
+                                 order_only,
+                                 JavacClientScript(input()),
+                                 JavacServerSource(input()));
   Makefile::Rule* rule = out->StartRule(
       touchfile.path(),
-      strings::JoinWith(" ",
-                        strings::JoinAll(input_files.files(), " "),
-                        strings::JoinAll(sources_, " ")));
+      strings::JoinWith(" ", prerequisites, strings::JoinAll(sources_, " ")),
+      order_only);
 
   // Mkdir commands.
   for (const string d : directories) {
     rule->WriteCommand("mkdir -p " + d);
   }
 
-  // Compile command.
-  string compile = "javac";
+  // Compile command, see WriteMakeHead().
+  string compile = "$(" + string(kJavacCommand) + ")";
 
   // Collect class paths.
   set<string> java_classpath;
@@ -169,6 +416,7 @@ void JavaLibraryNode::WriteCompile(const ResourceFileSet& input_files,
       strings::JoinAll(sources_, " ")));
   rule->WriteCommand("mkdir -p " + touchfile.dirname());
   rule->WriteCommand("touch " + touchfile.path());
+  SetResourceClass("memory", rule);  // a JVM, or a big compile in one.
   out->FinishRule(rule);
 
   // Secondary rules depend on touchfile and make sure each classfile is in
@@ -199,6 +447,29 @@ void JavaLibraryNode::WriteCompile(const ResourceFileSet& input_files,
   out->FinishRule(rule);
 }
 
+// static
+void JavaLibraryNode::WriteMakeHead(const Input& input, Makefile* out) {
+  // javac runs in a long lived JVM, started by the first compile and gone
+  // after JAVAC_SERVER_IDLE seconds without one, as JVM startup and warmup
+  // are most of a small compile. JAVAC_SERVER=0 runs a javac each time.
+  out->append("# Java settings.\n");
+  out->append("JAVA ?= java\n"
+              "JAVAC ?= javac\n"
+              "JAVAC_SERVER ?= 1\n"
+              "JAVAC_SERVER_IDLE ?= 900\n");
+  out->append("ifeq ($(JAVAC_SERVER),1)\n" +
+              string(kJavacCommand) + " = " + JavacClientScript(input) + " " +
+              JavacServerDir(input) + " $(JAVAC_SERVER_IDLE) "
+              "'$(JAVA)' '$(JAVAC)'\n"
+              "else\n" +
+              string(kJavacCommand) + " = $(JAVAC)\n"
+              "endif\n");
+  out->GenerateExecFile("JavacClientScript", JavacClientScript(input),
+                        kJavacClientScript);
+  out->GenerateExecFile("JavacServerSource", JavacServerSource(input),
+                        kJavacServerSource);
+}
+
 void JavaLibraryNode::LocalLinkFlags(LanguageType lang,
                                      std::set<std::string>* flags) const {
   if (lang == JAVA) {
@@ -37,6 +37,8 @@ class JavaLibraryNode : public Node {
   virtual void LocalDependencyFiles(LanguageType lang,
                                     ResourceFileSet* files) const;
 
+  static void WriteMakeHead(const Input& input, Makefile* out);
+
   // For direct construction.
   void Set(BuildFile* file,
            const BuildFileNode& input,
@@ -19,6 +19,14 @@ using std::vector;
 using std::string;
 
 namespace repobuild {
+namespace {
+string JoinCommands(const string& first, const string& second) {
+  if (first.empty() || second.empty()) {
+    return first + second;
+  }
+  return first + " && " + second;
+}
+}  // anonymous namespace
 
 void MakeNode::ParseWithOptions(BuildFile* file,
                                 const BuildFileNode& input,
@@ -77,16 +85,15 @@ void MakeNode::ParseWithOptions(BuildFile* file,
   gen->SetCd(true);
   gen->SetMakeName("Make");
 
-  string make_cmd = ("$MAKE " + make_args_str + " -f " + make_file + " "
-                     + make_target);
-  if (!preinstall.empty()) {
-    make_cmd = preinstall + " && " + make_cmd;
-  }
-  if (!postinstall.empty()) {
-    make_cmd += " && " + postinstall;
-  }
-  if (!user_postinstall.empty()) {
-    make_cmd += " && " + user_postinstall;
+  // Only the sub-make runs on a "+" line, the rest waits for "make -n" to
+  // be run for real. Each line is a shell of its own, so both need the
+  // preinstall setup.
+  string make_cmd = JoinCommands(
+      preinstall, "$MAKE " + make_args_str + " -f " + make_file + " " +
+      make_target);
+  string install_cmd = JoinCommands(postinstall, user_postinstall);
+  if (!install_cmd.empty()) {
+    install_cmd = JoinCommands(preinstall, install_cmd);
   }
   string clean_cmd = ("$MAKE " +  make_args_str + " clean > /dev/null 2>&1 "
                       "|| echo -n \"\"");  // always succeed.
@@ -97,7 +104,8 @@ void MakeNode::ParseWithOptions(BuildFile* file,
   vector<Resource> output_files;
   current_reader()->ParseRepeatedFiles("outs", false, &output_files);
 
-  gen->Set(make_cmd,
+  gen->SetRecursiveCmd(make_cmd);
+  gen->Set(install_cmd,
            clean_cmd,
            input_files,
            output_files);
@@ -1,18 +1,55 @@
 // Copyright 2013
 // Author: Christopher Van Arsdale
 
+#include <map>
 #include <string>
 #include <set>
+#include <vector>
 #include "common/strings/path.h"
 #include "common/strings/strutil.h"
 #include "repobuild/nodes/makefile.h"
 
 using std::set;
 using std::string;
+using std::vector;
 
 namespace repobuild {
 namespace {
 const char kPrereqRuleFile[] = ".dummy.prereqs";
+const char kPoolScriptFile[] = "pool.pl";
+
+// Runs a command holding one of the slots of a pool: the lock files
+// <dir>/0 .. <dir>/<depth - 1>. We take a free slot if there is one, and
+// otherwise sleep in flock() on a slot picked by pid, which spreads out the
+// waiters (and never spins while holding a job slot of make).
+const char kPoolScript[] =
+    "#!/usr/bin/perl\n"
+    "use warnings;\n"
+    "use strict;\n"
+    "use Fcntl qw(:flock);\n"
+    "use File::Path qw(make_path);\n"
+    "\n"
+    "my $dir = shift;\n"
+    "my $depth = shift;\n"
+    "if (!$dir || !defined($depth) || $depth !~ /^\\d+$/ || !@ARGV) {\n"
+    "    die(\"usage: $0 <dir> <depth> <command...>\\n\");\n"
+    "}\n"
+    "$depth = 1 if ($depth < 1);\n"
+    "make_path($dir);\n"
+    "sub Slot {\n"
+    "    my ($i, $mode) = @_;\n"
+    "    open(my $fh, '>>', \"$dir/$i\") || die(\"$dir/$i: $!\\n\");\n"
+    "    return flock($fh, $mode) ? $fh : undef;\n"
+    "}\n"
+    "my $slot;\n"
+    "for my $i (0 .. $depth - 1) {\n"
+    "    $slot = Slot($i, LOCK_EX | LOCK_NB);\n"
+    "    last if ($slot);\n"
+    "}\n"
+    "$slot = Slot($$ % $depth, LOCK_EX) if (!$slot);\n"
+    "die(\"$dir: $!\\n\") if (!$slot);\n"
+    "system { $ARGV[0] } @ARGV;\n"
+    "exit($? == -1 ? 127 : ($? & 127) ? 128 + ($? & 127) : $? >> 8);\n";
 }  // anonymous namespace
 
 Makefile::Rule* Makefile::StartRawRule(const string& rule,
@@ -28,19 +65,44 @@ Makefile::Rule* Makefile::StartPrereqRule(const string& rule,
 
 Makefile::Rule* Makefile::StartRule(const string& rule,
                                     const string& dependencies) {
+  return StartRule(rule, dependencies, "");
+}
+
+Makefile::Rule* Makefile::StartRule(const string& rule,
+                                    const string& dependencies,
+                                    const string& order_only) {
   return StartRawRule(rule, strings::JoinWith(" ", dependencies,
-                                              GetPrereqFile()));
+                                              "|", GetPrereqFile(),
+                                              order_only));
 }
 
 void Makefile::FinishRule(Makefile::Rule* rule) {
-  out_.append("\n");
-  out_.append(rule->rule() + ": " + rule->dependencies() + "\n");
-  out_.append(rule->out());  
-  out_.append("\n");
+  current_->append("\n");
+  current_->append(rule->rule() + ": " + rule->dependencies() + "\n");
+  current_->append(rule->out());
+  current_->append("\n");
+  if (!rule->depfile().empty()) {
+    current_->append("-include " + rule->depfile() + "\n");
+  }
+  for (const string& output : rule->outputs()) {
+    current_->append(output + ": " + rule->rule() + "\n");
+    registered_rules_.insert(output);
+  }
+  if (!rule->pool().empty()) {
+    // Private, or our prerequisites would inherit the pool.
+    // $(repobuild_pool_shell) is the shell it runs the commands with.
+    current_->append(rule->rule() + ": private SHELL = " + GetPoolScript() +
+                     "\n");
+    current_->append(rule->rule() + ": private .SHELLFLAGS = " +
+                     strings::JoinPath(scratch_dir_, "pools/" + rule->pool()) +
+                     " $(" + PoolDepthVariable(rule->pool()) + ")"
+                     " $(repobuild_pool_shell)\n");
+    pooled_ = true;
+  }
   for (const StringPiece& str : strings::Split(rule->rule(), " ")) {
     registered_rules_.insert(str.as_string());
   }
-  delete rule;
+  rules_.push_back(std::unique_ptr<Rule>(rule));
 }
 
 Makefile::Rule::Rule(const string& rule,
@@ -48,7 +110,9 @@ Makefile::Rule::Rule(const string& rule,
                      bool silent)
     : silent_(silent),
       rule_(rule),
-      dependencies_(dependencies) {
+      dependencies_(dependencies),
+      restat_(false),
+      cacheable_(false) {
 }
 
 void Makefile::Rule::WriteCommand(const string& command) {
@@ -58,6 +122,7 @@ void Makefile::Rule::WriteCommand(const string& command) {
   }
   out_.append(command);
   out_.append("\n");
+  commands_.push_back(command);
 }
 
 void Makefile::Rule::WriteCommandBestEffort(const string& command) {
@@ -67,10 +132,23 @@ void Makefile::Rule::WriteCommandBestEffort(const string& command) {
   }
   out_.append(command);
   out_.append("\n");
+  commands_.push_back("(" + command + ") || true");
+}
+
+void Makefile::Rule::WriteRecursiveCommand(const string& command) {
+  out_.append("\t+");
+  if (silent_) {
+    out_.append("@");
+  }
+  out_.append(command);
+  out_.append("\n");
+  commands_.push_back(command);
 }
 
 void Makefile::Rule::WriteUserEcho(const string& name,
                                    const string& value) {
+  kind_ = name;
+  label_ = value;
   WriteCommand(strings::StringPrintf("echo \"%-11s %s\"",
                                      (name + ":").c_str(),
                                      value.c_str()));
@@ -86,6 +164,11 @@ void Makefile::Rule::WriteUserEchoFileCheck(const string& name,
 }
 
 void Makefile::Rule::AddDependency(const string& dep) {
+  size_t order_only = dependencies_.find('|');
+  if (order_only != string::npos) {
+    dependencies_.insert(order_only, dep + " ");
+    return;
+  }
   if (!dependencies_.empty()) {
     dependencies_ += " ";
   }
@@ -121,16 +204,31 @@ void Makefile::GenerateExecFile(const string& name,
   append("define " + name + "\n");
   append(strings::Base64Encode(value));
   append("\nendef\n");
-  append("export " + name + "\n");
   Makefile::Rule* rule = StartRawRule(file_path, "");
   rule->WriteCommand("mkdir -p " + strings::PathDirname(file_path));
-  rule->WriteCommand("echo \"$$" + name + "\" | base64 --decode > "
+  rule->WriteCommand("echo \"$(" + name + ")\" | base64 --decode > "
                      + file_path);
   rule->WriteCommand("chmod 0755 " + file_path);
   FinishRule(rule);
 }
 
+void Makefile::StartFragment(const string& path) {
+  current_ = &fragments_[path];
+}
+
+// static
+const vector<string>& Makefile::ResourceClasses() {
+  static const vector<string> kClasses = { "cpu", "memory", "link" };
+  return kClasses;
+}
+
 void Makefile::FinishMakefile() {
+  if (pooled_) {
+    append("repobuild_pool_shell ?= /bin/sh -c\n");
+    GenerateExecFile("repobuild_pool_script", GetPoolScript(), kPoolScript);
+    prereq_rules_.insert(GetPoolScript());
+  }
+
   Rule* rule = StartRawRule(GetPrereqFile(),
                             strings::JoinAll(prereq_rules_, " "));
   rule->WriteCommand("mkdir -p " + scratch_dir_);
@@ -145,6 +243,10 @@ string Makefile::GetPrereqFile() const {
   return scratch_dir_ + "/" + kPrereqRuleFile;
 }
 
+string Makefile::GetPoolScript() const {
+  return scratch_dir_ + "/" + kPoolScriptFile;
+}
+
 // static
 string Makefile::Escape(const string& input) {
   return strings::ReplaceAll(input, "$", "$$");
@@ -4,8 +4,11 @@
 #ifndef _REPOBUILD_NODES_MAKEFILE_H__
 #define _REPOBUILD_NODES_MAKEFILE_H__
 
+#include <map>
+#include <memory>
 #include <set>
 #include <string>
+#include <vector>
 #include "common/strings/strutil.h"
 
 namespace repobuild {
@@ -16,7 +19,9 @@ class Makefile {
                     const std::string& scratch_dir) 
       : silent_(true),
         root_dir_(root_dir),
-        scratch_dir_(scratch_dir) {
+        scratch_dir_(scratch_dir),
+        current_(&out_),
+        pooled_(false) {
   }
   ~Makefile() {}
 
@@ -33,8 +38,13 @@ class Makefile {
     // Adding commands to our rule.
     void WriteCommand(const std::string& command);
     void WriteCommandBestEffort(const std::string& command);
+    // For commands running a sub-make: they join our jobserver, and run even
+    // with "make -n", so keep any other work off these lines.
+    void WriteRecursiveCommand(const std::string& command);
+    // Prints "name: value". The last one also names the rule's action, e.g.
+    // "Linking" and the binary, for build events (see kind() and label()).
     void WriteUserEcho(const std::string& name,
-                       const std::string& value);  // prints "name: value".
+                       const std::string& value);
     void WriteUserEchoFileCheck(const std::string& name,
                                 const std::string& value,
                                 const std::string& file);  // iff file missing.
@@ -42,22 +52,63 @@ class Makefile {
 
     void AddDependency(const std::string& dep);
 
+    // Another file our commands write. Make sees it as depending on this
+    // rule (without grouped targets a recipe cannot have several outputs);
+    // ninja as another output of it, which matters for restat.
+    void AddOutput(const std::string& output) { outputs_.push_back(output); }
+
+    // Hints for other build tools (see generator/ninja.h); make ignores all
+    // but the depfile, which it includes.
+    // The compiler writes the headers it read to 'depfile' ("-MMD -MP").
+    void SetDepfile(const std::string& depfile) { depfile_ = depfile; }
+    // Our commands may leave outputs untouched, dependents need not rerun.
+    void SetRestat() { restat_ = true; }
+    // Our commands read only our prerequisites (and the depfile's headers)
+    // and write only our outputs, so "repobuild build" may restore them from
+    // its action cache or run them remotely. Most rules cannot promise that:
+    // stamps, scripts, and tools that read the tree.
+    void SetCacheable() { cacheable_ = true; }
+    // Limits how many rules of 'pool' (a resource class other than "cpu",
+    // see ResourceClasses()) run at once, to the POOL_DEPTH.<pool> make
+    // variable. Under make the commands run through a semaphore script.
+    void SetPool(const std::string& pool) { pool_ = pool; }
+
     // Raw access.
     std::string* mutable_out() { return &out_; }
     const std::string& out() const { return out_; }
     const std::string& rule() const { return rule_; }
     const std::string& dependencies() const { return dependencies_; }
+    const std::vector<std::string>& outputs() const { return outputs_; }
+    const std::vector<std::string>& commands() const { return commands_; }
+    const std::string& depfile() const { return depfile_; }
+    bool restat() const { return restat_; }
+    bool cacheable() const { return cacheable_; }
+    const std::string& pool() const { return pool_; }
+    const std::string& kind() const { return kind_; }
+    const std::string& label() const { return label_; }
 
    private:
     bool silent_;
     std::string rule_;
     std::string dependencies_;
     std::string out_;
+    std::vector<std::string> outputs_;
+    std::vector<std::string> commands_;  // shell commands, in order.
+    std::string depfile_;
+    bool restat_;
+    bool cacheable_;
+    std::string pool_;
+    std::string kind_, label_;
   };
 
-  // Rules
+  // Rules. The prereqs stamp (see StartPrereqRule) is order-only: it must
+  // exist first, but never makes 'rule' stale.
   Rule* StartRule(const std::string& rule) { return StartRule(rule, ""); }
   Rule* StartRule(const std::string& rule, const std::string& dependencies);
+  // Likewise for 'order_only' prerequisites.
+  Rule* StartRule(const std::string& rule,
+                  const std::string& dependencies,
+                  const std::string& order_only);
   void FinishRule(Rule* rule);
   void WriteRule(const std::string& rule, const std::string& deps) {
     FinishRule(StartRule(rule, deps));
@@ -71,13 +122,33 @@ class Makefile {
     return registered_rules_.find(rule) != registered_rules_.end();
   }
 
+  // Every finished rule, in order.
+  const std::vector<std::unique_ptr<Rule> >& rules() const { return rules_; }
+
   void FinishMakefile();
 
-  // Full access.
-  std::string* mutable_out() { return &out_; }
+  // Fragments. After StartFragment(path), everything written goes to a
+  // separate buffer, to be saved as 'path'. EndFragment() goes back to the
+  // main makefile. The caller is responsible for including the fragments
+  // and for writing fragments() to disk.
+  void StartFragment(const std::string& path);
+  void EndFragment() { current_ = &out_; }
+  const std::map<std::string, std::string>& fragments() const {
+    return fragments_;
+  }
+
+  // Resource classes of rules: "cpu" rules are only limited by the number
+  // of jobs, "memory" (memory hungry) and "link" rules also by their pool.
+  static const std::vector<std::string>& ResourceClasses();
+  static std::string PoolDepthVariable(const std::string& pool) {
+    return "POOL_DEPTH." + pool;
+  }
+
+  // Full access (to the current fragment).
+  std::string* mutable_out() { return current_; }
   const std::string& out() const { return out_; }
   template <typename T> void append(const T& t) {
-    out_.append(strings::StringPrint(t));
+    current_->append(strings::StringPrint(t));
   }
 
   // Symlink shortcuts.
@@ -99,12 +170,17 @@ class Makefile {
 
  private:
   std::string GetPrereqFile() const;
+  std::string GetPoolScript() const;
 
   bool silent_;
   std::string root_dir_, scratch_dir_;
   std::string out_;
+  std::map<std::string, std::string> fragments_;
+  std::string* current_;  // out_ or a fragment.
   std::set<std::string> registered_rules_;
   std::set<std::string> prereq_rules_;
+  std::vector<std::unique_ptr<Rule> > rules_;
+  bool pooled_;  // some rule has a pool.
 };
 
 }  // namespace repobuild
@@ -77,6 +77,16 @@ void Node::Parse(BuildFile* file, const BuildFileNode& input) {
 
   // Parse licence info.
   current_reader()->ParseRepeatedString("licenses", &licenses_);
+
+  // What its actions need most, to limit how many run at once.
+  current_reader()->ParseStringField("resource_class", &resource_class_);
+  const vector<string>& classes = Makefile::ResourceClasses();
+  CHECK(resource_class_.empty() ||
+        std::find(classes.begin(), classes.end(), resource_class_) !=
+        classes.end())
+      << "Unknown resource_class \"" << resource_class_ << "\" for "
+      << target().full_path() << ", expected one of: "
+      << strings::JoinAll(classes, ", ");
 }
 
 void Node::PostParse() {
@@ -84,7 +94,15 @@ void Node::PostParse() {
 }
 
 void Node::WriteMake(Makefile* out) const {
+  WriteMakeVariables(out);
+  WriteMakeRules(out);
+}
+
+void Node::WriteMakeVariables(Makefile* out) const {
   WriteVariables(out->mutable_out());
+}
+
+void Node::WriteMakeRules(Makefile* out) const {
   LocalWriteMake(out);
 }
 
@@ -372,23 +390,29 @@ void Node::WriteBaseUserTarget(const ResourceFileSet& deps,
     return;
   }
 
-  out->append(target().make_path());
-  out->append(":");
+  // A rule, so the ninja graph (and "repobuild build") has the target too.
+  string prerequisites;
   for (const Resource& dep : deps.files()) {
-    out->append(" ");
-    out->append(dep.path());
+    prerequisites = strings::JoinWith(" ", prerequisites, dep.path());
   }
   for (const TargetInfo& dep : dep_targets()) {
     if (dep.make_path() != target().make_path()) {
-      out->append(" ");
-      out->append(dep.make_path());
+      prerequisites = strings::JoinWith(" ", prerequisites, dep.make_path());
     }
   }
-  out->append("\n\n.PHONY: ");
+  out->FinishRule(out->StartRawRule(target().make_path(), prerequisites));
+  out->append(".PHONY: ");
   out->append(target().make_path());
   out->append("\n\n");
 }
 
+void Node::SetResourceClass(const string& default_class,
+                            Makefile::Rule* rule) const {
+  string resource_class = (resource_class_.empty() ? default_class :
+                           resource_class_);
+  rule->SetPool(resource_class == "cpu" ? "" : resource_class);
+}
+
 Node::MakeVariable::MakeVariable(const string& name)
     : name_(name) {
 }
@@ -451,6 +475,16 @@ Resource Node::Touchfile(const string& suffix) const {
       "." + target().local_path() + suffix + ".dummy");
 }
 
+// static
+void Node::SplitOrderOnly(const ResourceFileSet& files,
+                          string* prerequisites,
+                          string* order_only) {
+  for (const Resource& file : files) {
+    string* out = (file.has_tag("order_only") ? order_only : prerequisites);
+    *out = strings::JoinWith(" ", *out, file.path());
+  }
+}
+
 void Node::WriteVariables(string* out) const {
   for (auto const& it : make_variables_) {
     it.second->WriteMake(out);
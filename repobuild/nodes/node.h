@@ -45,8 +45,12 @@ class Node {
   virtual void Parse(BuildFile* file, const BuildFileNode& input);
   virtual void PostParse();
 
-  // Makefile generation.
+  // Makefile generation. WriteMake == WriteMakeVariables + WriteMakeRules.
+  // Variables may be referenced by any node's rules, so when splitting the
+  // output every node's variables must be written before any rules.
   void WriteMake(Makefile* out) const;
+  void WriteMakeVariables(Makefile* out) const;
+  void WriteMakeRules(Makefile* out) const;
   void WriteMakeClean(Makefile::Rule* rule) const;
   void WriteMakeInstall(Makefile* base, Makefile::Rule* rule) const;
 
@@ -174,6 +178,11 @@ class Node {
   Resource Touchfile() const { return Touchfile(""); }
   void WriteBaseUserTarget(const ResourceFileSet& deps, Makefile* out) const;
   void WriteBaseUserTarget(Makefile* out) const;
+  // Puts the rule of a heavy action (a compile, a link) in the pool of its
+  // resource class (see Makefile::ResourceClasses()): our "resource_class"
+  // if the BUILD file sets one, 'default_class' otherwise.
+  void SetResourceClass(const std::string& default_class,
+                        Makefile::Rule* rule) const;
   void WriteVariables(std::string* out) const;
   bool HasVariable(const std::string& name) const;
   const MakeVariable& GetVariable(const std::string& name) const;
@@ -183,6 +192,13 @@ class Node {
                               const std::string& true_value,
                               const std::string& false_value);
 
+  // Splits 'files' into rule prerequisites and order-only prerequisites:
+  // those tagged "order_only" are stamps saying that something exists, and
+  // must never make a rule stale.
+  static void SplitOrderOnly(const ResourceFileSet& files,
+                             std::string* prerequisites,
+                             std::string* order_only);
+
   // Dependency helpers
   void InputDependencyFiles(LanguageType lang, ResourceFileSet* files) const;
   void InputObjectFiles(LanguageType lang, ResourceFileSet* files) const;
@@ -248,6 +264,7 @@ class Node {
 
   // Parsing info
   bool strict_file_mode_;
+  std::string resource_class_;
   std::unique_ptr<BuildFileNodeReader> build_reader_;
   std::map<std::string, std::string> env_variables_;
   std::vector<std::string> licenses_;
@@ -71,10 +71,12 @@ void PyEggNode::WriteEggFile(const ResourceFileSet& deps,
   // Output egg file
   Resource egg_touchfile = Touchfile(".egg");
   Resource egg_bin = OutEgg();
+  string prerequisites, order_only;
+  SplitOrderOnly(deps, &prerequisites, &order_only);
   Makefile::Rule* rule =
       out->StartRule(egg_touchfile.path(),
-                     strings::Join(strings::JoinAll(deps.files(), " "), " ",
-                                   SetupFile(input())));
+                     strings::JoinWith(" ", prerequisites, SetupFile(input())),
+                     order_only);
   rule->WriteUserEcho("Python build", egg_bin.path());
   rule->WriteCommand("mkdir -p " + egg_touchfile.dirname());
   rule->WriteCommand(
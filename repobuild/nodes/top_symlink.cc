@@ -31,7 +31,8 @@ void TopSymlinkNode::LocalWriteMake(Makefile* out) const {
     out->WriteRootSymlink(local.path(), r.path());
     out->WriteRootSymlink(bin.path(), r.path());
   }
-  WriteBaseUserTarget(out);
+  // The binary's user target depends on ours, so this is what builds it.
+  WriteBaseUserTarget(OutBinaries(), out);
 }
 
 void TopSymlinkNode::LocalFinalOutputs(LanguageType lang,
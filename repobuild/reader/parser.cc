@@ -8,7 +8,6 @@
 #include <queue>
 #include <vector>
 #include "common/log/log.h"
-#include "common/file/fileutil.h"
 #include "common/strings/path.h"
 #include "common/util/stl.h"
 #include "repobuild/distsource/dist_source.h"
@@ -110,7 +109,7 @@ class Graph {
     for (const TargetInfo& info : input_.build_targets()) {
       const string& cleaned = info.full_path();
       if (queued_targets.insert(cleaned).second) {
-        to_process_.push(cleaned);
+        Enqueue(info);
       }
     }
 
@@ -171,7 +170,7 @@ class Graph {
     ProcessParent(file);  // inherit anything we need to from parents.
 
     // Parse the BUILD into a structured format.
-    string filestr = file::ReadFileToStringOrDie(file->filename());
+    string filestr = dist_source_->ReadFile(file->filename());
     file->Parse(filestr);
 
     // Get the dependent files.
@@ -241,7 +240,7 @@ class Graph {
         VLOG(1) << "Adding dep: "
                 << node->target().full_path()
                 << " -> " << dep.full_path();
-        to_process_.push(dep.full_path());
+        Enqueue(dep);
       }
     }
     for (const TargetInfo& dep : node->required_parents()) {
@@ -249,11 +248,19 @@ class Graph {
         VLOG(1) << "Saw parent request: "
                 << node->target().full_path()
                 << " -> " << dep.full_path();
-        to_process_.push(dep.full_path());
+        Enqueue(dep);
       }
     }
   }
 
+  // Enqueue
+  //  Queue a target for ProcessTarget, and let the source tree start fetching
+  //  its BUILD file while we parse the rest of the frontier.
+  void Enqueue(const TargetInfo& target) {
+    dist_source_->PrefetchForFile(target.build_file());
+    to_process_.push(target.full_path());
+  }
+
   // ProcessTarget
   //  Given a target string, process the node.
   //   1) Figure out if we have to process the file.
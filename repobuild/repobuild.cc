@@ -16,7 +16,18 @@
 //  ./repbuild ":repobuild" && make repobuild
 //
 
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 #include "common/base/init.h"
 #include "common/base/flags.h"
@@ -26,28 +37,134 @@
 #include "common/strings/strutil.h"
 #include "common/strings/stringpiece.h"
 #include "repobuild/distsource/dist_source_impl.h"
+#include "repobuild/distsource/git_revision_source.h"
 #include "repobuild/env/input.h"
 #include "repobuild/env/target.h"
+#include "repobuild/executor/action_cache.h"
+#include "repobuild/executor/action_graph.h"
+#include "repobuild/executor/build_events.h"
+#include "repobuild/executor/executor.h"
+#include "repobuild/executor/http_cache_store.h"
+#include "repobuild/executor/http.h"
+#include "repobuild/executor/remote_executor.h"
+#include "repobuild/generator/action_log.h"
 #include "repobuild/generator/generator.h"
+#include "repobuild/generator/ninja.h"
+#include "repobuild/nodes/makefile.h"
 
+using std::map;
+using std::string;
 using std::vector;
 
 DEFINE_string(makefile, "Makefile",
               "Name of makefile output.");
 
+DEFINE_bool(split_makefile, true,
+            "If true, the makefile only holds global settings and includes "
+            "the variables and rules of each package from .gen-files/mk, "
+            "reading only the packages its goals need. Those are rewritten "
+            "only when they change. Ignored with --at_revision.");
+
+DEFINE_string(at_revision, "",
+              "If set, read BUILD files and source globs from this git "
+              "revision (anything git rev-parse accepts) instead of the work "
+              "tree. Nothing is checked out, so generating the Makefile for "
+              "two revisions and diffing them shows how the build graph "
+              "changed. The makefile is not split (see --split_makefile), "
+              "so it holds the whole graph. Not for \"repobuild build\".");
+
+DEFINE_string(ninja, "",
+              "If set (e.g. build.ninja), also write a ninja manifest for the "
+              "same build. Ninja expands it from the makefile on its first "
+              "run, which takes GNU make 4.0 or later.");
+
+DEFINE_int32(pool_depth, 4,
+             "How many actions of each pool (links, and memory hungry "
+             "actions such as javac) may run at once, under make, ninja or "
+             "\"repobuild build\". Compiles are only limited by the number "
+             "of jobs.");
+
+DEFINE_string(pool_depths, "",
+              "Overrides --pool_depth for some pools, e.g. "
+              "\"link=2,memory=8\" to run -j64 in 64GB with 8GB links. "
+              "\"make POOL_DEPTH.link=2\" overrides it again. BUILD targets "
+              "may move their actions to another pool with "
+              "\"resource_class\": \"cpu\", \"memory\" or \"link\".");
+
+DEFINE_int32(jobs, 0,
+             "For \"repobuild build\": how many actions may run at once, "
+             "0 for one per core.");
+
+DEFINE_string(action_cache, "",
+              "For \"repobuild build\": if set (e.g. ~/.cache/repobuild, or a "
+              "directory shared over NFS), restore the outputs of actions "
+              "that already ran with the same command and inputs from this "
+              "directory, and store new ones there.");
+
+DEFINE_string(remote_cache, "",
+              "For \"repobuild build\": if set (e.g. http://host:8380, see "
+              "executor/cache_server.cc), also look actions up on this cache "
+              "server, after --action_cache, and upload new ones to it.");
+
+DEFINE_string(remote_token_file, "",
+              "For \"repobuild build\": a file with the token of "
+              "--remote_workers, and of --remote_cache if it has one (see "
+              "--token_file of executor/worker.cc and cache_server.cc).");
+
+DEFINE_string(remote_workers, "",
+              "For \"repobuild build\": comma separated workers (host:port, "
+              "or host:8400-8403 for a range, see executor/worker.cc) to run "
+              "compiles and links on. Inputs and outputs go through "
+              "--remote_cache, which they must share.");
+
+DEFINE_string(build_events, "",
+              "For \"repobuild build\": if set, report the build as JSON "
+              "lines (see executor/build_events.h) appended to this file, or "
+              "sent to a listening Unix socket with unix:/path/to/socket.");
+
+DEFINE_bool(critical_path, false,
+            "If true, report the critical path of building the targets with "
+            "the durations recorded by --time_actions, the slack of every "
+            "target, and what speeding up each action on the path would "
+            "save. Nothing is generated.");
+
+DEFINE_string(export_action_trace, "",
+              "If set, write the actions recorded with --time_actions to this "
+              "file in Chrome trace format (chrome://tracing), and exit.");
+
 namespace {
 const char* kUsage =
     "\n\n"
     "  To generate makefile:\n"
     "     repobuild \"path/to/dir:target\" [--makefile=Makefile]\n"
     "\n"
+    "  To generate the makefile of another commit, without checking it out:\n"
+    "     repobuild \"path/to/dir:target\" --at_revision=HEAD~1 "
+    "--makefile=Makefile.old\n"
+    "     repobuild \"path/to/dir:target\" --split_makefile=false\n"
+    "     diff Makefile.old Makefile\n"
+    "\n"
     "  To build:\n"
     "     make [-j8] [target]\n"
+    "         or, after repobuild --ninja=build.ninja\n"
+    "     ninja [target]\n"
+    "         or, without make\n"
+    "     repobuild build \"path/to/dir:target\" [--jobs=8] "
+    "[--action_cache=$HOME/.cache/repobuild] "
+    "[--remote_cache=http://host:8380] "
+    "[--remote_workers=host:8400-8403] [--remote_token_file=path/to/token]\n"
     "\n"
     "  To run:\n"
     "     ./.gen-obj/path/to/target\n"
     "         or\n"
-    "     ./target";
+    "     ./target\n"
+    "\n"
+    "  To see where a build spent its time:\n"
+    "     repobuild \"path/to/dir:target\" --time_actions && make [-j8]\n"
+    "     repobuild --export_action_trace=trace.json\n"
+    "     repobuild \"path/to/dir:target\" --critical_path\n"
+    "     repobuild build \"path/to/dir:target\" "
+    "--build_events=unix:/path/to/socket";
 
 void ParseArg(bool no_flags,
               const StringPiece& arg,
@@ -66,6 +183,178 @@ void ParseArg(bool no_flags,
     input->AddBuildTarget(repobuild::TargetInfo::FromUserPath(arg.as_string()));
   }
 }
+
+// --pool_depth for every pool, with the --pool_depths overrides.
+bool ParsePoolDepths(const string& flag, map<string, int>* depths) {
+  for (const string& pool : repobuild::Makefile::ResourceClasses()) {
+    (*depths)[pool] = FLAGS_pool_depth;
+  }
+  for (const string& entry : strings::SplitString(flag, ",")) {
+    if (entry.empty()) {
+      continue;
+    }
+    size_t equals = entry.find('=');
+    string pool = entry.substr(0, equals);
+    int depth = (equals == string::npos ? 0 :
+                 atoi(entry.c_str() + equals + 1));
+    if (pool == "cpu" || depths->find(pool) == depths->end() || depth <= 0) {
+      LOG(ERROR) << "Invalid --pool_depths entry, expected link=N or "
+                 << "memory=N: " << entry;
+      return false;
+    }
+    (*depths)[pool] = depth;
+  }
+  return true;
+}
+
+void MakeDirs(const string& dir) {
+  if (dir.empty() || dir == "." || dir == "/") {
+    return;
+  }
+  MakeDirs(strings::PathDirname(dir));
+  mkdir(dir.c_str(), 0755);
+}
+
+// "~/x" is under $HOME.
+string ExpandHome(const string& path) {
+  if (strings::HasPrefix(path, "~/") && getenv("HOME") != NULL) {
+    return strings::JoinPath(getenv("HOME"), path.substr(2));
+  }
+  return path;
+}
+
+// "repobuild build": runs the actions of our targets ourselves, from the
+// expanded manifest in 'graph_file' (expanding it first if need be).
+// 'source' (of the work tree) fingerprints its source files.
+bool BuildTargets(const repobuild::Input& input, const string& graph_file,
+                  repobuild::DistSource* source) {
+  if (chdir(input.root_dir().c_str()) != 0) {
+    LOG(FATAL) << "Could not change to " << input.root_dir();
+  }
+  repobuild::NinjaWriter ninja(
+      FLAGS_makefile, graph_file,
+      repobuild::NinjaWriter::ExpandFile(input.genfile_dir(), graph_file));
+  int jobs = (FLAGS_jobs > 0 ? FLAGS_jobs :
+              std::max<int>(1, std::thread::hardware_concurrency()));
+  string token;
+  if (!FLAGS_remote_token_file.empty() &&
+      !repobuild::ReadTokenFile(ExpandHome(FLAGS_remote_token_file), &token)) {
+    return false;
+  }
+
+  std::unique_ptr<repobuild::HttpCacheStore> remote_cas;
+  std::unique_ptr<repobuild::RemoteExecutor> remote;
+  if (!FLAGS_remote_workers.empty()) {
+    if (!repobuild::HttpClient::ValidUrl(FLAGS_remote_cache)) {
+      LOG(ERROR) << "--remote_workers needs --remote_cache=http://host:port";
+      return false;
+    }
+    if (token.empty()) {
+      LOG(ERROR) << "--remote_workers needs --remote_token_file.";
+      return false;
+    }
+    remote_cas.reset(new repobuild::HttpCacheStore(FLAGS_remote_cache));
+    remote_cas->SetToken(token);
+    remote.reset(new repobuild::RemoteExecutor(remote_cas.get(),
+                                               input.full_root_dir()));
+    remote->SetDistSource(source);
+    remote->SetToken(token);
+    for (const string& address : strings::SplitString(FLAGS_remote_workers,
+                                                      ",")) {
+      remote->AddWorkers(address);
+    }
+    if (FLAGS_jobs <= 0) {
+      jobs += remote->TotalSlots();
+    }
+  }
+
+  std::unique_ptr<repobuild::BuildEventStream> events;
+  if (!FLAGS_build_events.empty()) {
+    events.reset(repobuild::BuildEventStream::Open(FLAGS_build_events));
+    if (events.get() == NULL) {
+      return false;
+    }
+  }
+
+  std::unique_ptr<repobuild::ActionGraph> graph;
+  std::unique_ptr<repobuild::Executor> executor;
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    executor.reset();
+    graph.reset(new repobuild::ActionGraph);
+    std::ifstream in(graph_file.c_str());
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    if (in && graph->Parse(contents.str())) {
+      // The executor sizes its state by the parsed graph.
+      executor.reset(new repobuild::Executor(graph.get(), jobs));
+      if (attempt > 0 || !executor->NeedsRegeneration()) {
+        break;
+      }
+    }
+    if (attempt > 0 || system(ninja.ExpandCommand().c_str()) != 0) {
+      LOG(ERROR) << "Could not expand " << graph_file;
+      return false;
+    }
+  }
+  std::unique_ptr<repobuild::ActionCache> cache;
+  if (!FLAGS_action_cache.empty() || !FLAGS_remote_cache.empty()) {
+    cache.reset(new repobuild::ActionCache);
+    cache->SetDistSource(source);
+    executor->SetActionCache(cache.get());
+  }
+  if (!FLAGS_action_cache.empty()) {
+    cache->AddStore(
+        new repobuild::DiskCacheStore(ExpandHome(FLAGS_action_cache)));
+  }
+  if (!FLAGS_remote_cache.empty()) {
+    if (!repobuild::HttpClient::ValidUrl(FLAGS_remote_cache)) {
+      LOG(ERROR) << "Invalid --remote_cache, expected http://host[:port]: "
+                 << FLAGS_remote_cache;
+      return false;
+    }
+    repobuild::HttpCacheStore* store =
+        new repobuild::HttpCacheStore(FLAGS_remote_cache);
+    store->SetToken(token);
+    cache->AddStore(store);
+  }
+  executor->SetRemoteExecutor(remote.get());
+  executor->SetEventStream(events.get());
+  if (input.time_actions()) {
+    executor->SetActionLog(repobuild::ActionLog::LogFile(input));
+  }
+
+  // Start the long poles first, going by the last --time_actions build.
+  std::ifstream log_in(repobuild::ActionLog::LogFile(input).c_str());
+  if (log_in) {
+    std::ostringstream log_contents;
+    log_contents << log_in.rdbuf();
+    repobuild::ActionLog log;
+    log.Parse(log_contents.str());
+    map<string, int64_t> durations;
+    log.LatestDurations(&durations);
+    executor->SetDurations(durations);
+  }
+
+  vector<string> targets;
+  for (const repobuild::TargetInfo& target : input.build_targets()) {
+    targets.push_back(target.make_path());
+  }
+  return executor->Build(targets);
+}
+
+// Leaves the file (and its mtime) alone if it already has 'contents'.
+void WriteFileIfChanged(const string& path, const string& contents) {
+  std::ifstream in(path.c_str());
+  if (in) {
+    std::ostringstream current;
+    current << in.rdbuf();
+    if (current.str() == contents) {
+      return;
+    }
+  }
+  MakeDirs(strings::PathDirname(path));
+  file::WriteFileOrDie(path, contents);
+}
 }  // anonymous namespace
 
 int main(int argc, char** argv) {
@@ -81,10 +370,22 @@ int main(int argc, char** argv) {
     }
   }
 
+  // "repobuild build ..." builds the targets instead of just generating.
+  bool build = (!saved_args.empty() && !strcmp(saved_args[0], "build"));
+  if (build) {
+    saved_args.erase(saved_args.begin());
+  }
+
   // Initialize flags, etc.
   int size = ignored_args.size();
   char** args = &ignored_args[0];
   InitProgram(&size, &args, kUsage, true);
+  if (build && !FLAGS_at_revision.empty()) {
+    // Its graph would run against the sources of the work tree.
+    LOG(ERROR) << "\"repobuild build\" builds the work tree, it does not "
+               << "take --at_revision.";
+    return 1;
+  }
 
   // Parse arguments.
   // 1) Arguments for compilation (-C=a, -X=a, -L=a, etc ... see env/input.cc)
@@ -100,13 +401,71 @@ int main(int argc, char** argv) {
     ParseArg(true, args[i], &input);
   }
 
+  if (!FLAGS_export_action_trace.empty()) {
+    repobuild::ActionLog log;
+    log.Parse(file::ReadFileToStringOrDie(
+        strings::JoinPath(input.root_dir(),
+                          repobuild::ActionLog::LogFile(input))));
+    file::WriteFileOrDie(FLAGS_export_action_trace, log.ChromeTrace());
+    std::cout << "Wrote " << log.actions().size() << " actions to "
+              << FLAGS_export_action_trace << std::endl;
+    return 0;
+  }
+
   // Set up our distributed source tree.
-  repobuild::DistSourceImpl source(input.full_root_dir());
+  std::unique_ptr<repobuild::DistSource> source;
+  if (FLAGS_at_revision.empty()) {
+    source.reset(new repobuild::DistSourceImpl(input.full_root_dir()));
+  } else {
+    source.reset(new repobuild::GitRevisionSource(input.full_root_dir(),
+                                                  FLAGS_at_revision));
+  }
 
-  // Generate the output Makefile.
-  repobuild::Generator generator(&source);
-  file::WriteFileOrDie(strings::JoinPath(input.root_dir(), FLAGS_makefile),
-                       generator.GenerateMakefile(input));
+  repobuild::Generator generator(source.get());
+  if (FLAGS_critical_path) {
+    repobuild::ActionLog log;
+    log.Parse(file::ReadFileToStringOrDie(
+        strings::JoinPath(input.root_dir(),
+                          repobuild::ActionLog::LogFile(input))));
+    std::cout << generator.CriticalPathReport(input, log);
+    return 0;
+  }
 
+  // Generate the output Makefile. Fragment paths are relative to the root,
+  // and each makefile name gets its own fragments.
+  map<string, int> pool_depths;
+  if (!ParsePoolDepths(FLAGS_pool_depths, &pool_depths)) {
+    return 1;
+  }
+  generator.SetPoolDepths(pool_depths);
+  if (!FLAGS_ninja.empty()) {
+    generator.SetNinjaFile(FLAGS_makefile, FLAGS_ninja);
+  }
+  string graph_file = strings::JoinPath(input.genfile_dir(), "actions.ninja");
+  if (build) {
+    generator.SetActionGraphFile(FLAGS_makefile, graph_file);
+  }
+  // A split makefile only has include lines to diff.
+  string fragment_dir;
+  if (FLAGS_split_makefile && FLAGS_at_revision.empty()) {
+    fragment_dir = strings::JoinPath(input.genfile_dir(), "mk");
+    if (FLAGS_makefile != "Makefile") {
+      fragment_dir = strings::JoinPath(fragment_dir,
+                                       strings::PathBasename(FLAGS_makefile));
+    }
+  }
+  map<string, string> fragments;
+  string makefile = generator.GenerateMakefile(input, fragment_dir, &fragments);
+  for (const auto& it : fragments) {
+    WriteFileIfChanged(strings::JoinPath(input.root_dir(), it.first),
+                       it.second);
+  }
+  // Unchanged, so the expanded action graph stays current.
+  WriteFileIfChanged(strings::JoinPath(input.root_dir(), FLAGS_makefile),
+                     makefile);
+
+  if (build) {
+    return BuildTargets(input, graph_file, source.get()) ? 0 : 1;
+  }
   return 0;
 }
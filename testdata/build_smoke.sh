@@ -0,0 +1,22 @@
+#!/bin/sh
+# Smoke test of "repobuild build", the built-in executor: builds
+# //testdata/e:main (an ephemeral source and a link) in a scratch copy of
+# testdata, runs it, then builds again expecting nothing to do.
+#
+# Usage, from the repository root:
+#   testdata/build_smoke.sh [path/to/repobuild]
+set -e
+
+REPOBUILD=${1:-./repobuild}
+REPOBUILD=$(cd "$(dirname "$REPOBUILD")" && pwd)/$(basename "$REPOBUILD")
+ROOT=$(mktemp -d)
+trap 'rm -rf "$ROOT"' EXIT
+cp BUILD "$ROOT/BUILD"
+cp -R testdata "$ROOT/testdata"
+cd "$ROOT"
+
+"$REPOBUILD" build "testdata/e:main" --build_events=events.jsonl
+./.gen-obj/testdata/e/main | grep "^Built on "
+grep -q '"event":"build_finished","success":true' events.jsonl
+"$REPOBUILD" build "testdata/e:main" | grep "Nothing to be done."
+echo PASS